@@ -15,10 +15,23 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "ftimer.h"
 #include "config.h"
 
 /**********************
@@ -30,14 +43,78 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Binary traces */
+#define BIN_MAGIC   "MMTRACE1" /* first 8 bytes of a binary trace file */
+#define BIN_ORDER   0x01020304 /* byte order mark of a binary trace */
+
+/* Packed traces */
+#define PACK_MAGIC  "MMTRACEZ" /* first 8 bytes of a packed trace file */
+#define PACK_RECENT          8 /* recent ids that id deltas are taken from */
+#define PACK_MAXOP          16 /* max bytes of a packed request */
+#define PACK_SAME_ID      0x40 /* tag bit: the id is the recent one */
+#define PACK_SAME_SIZE    0x80 /* tag bit: the size is the last one coded */
+
+/* zigzag maps deltas of small magnitude to small unsigned numbers */
+#define ZIGZAG(d)   ((((unsigned)(d)) << 1) ^ (0u - (((unsigned)(d)) >> 31)))
+#define UNZIGZAG(z) (((z) >> 1) ^ (0u - ((z) & 1)))
+
+/* true for the requests that give a size */
+#define HAS_SIZE(type) (((type) != FREE) && ((type) != USABLE))
+
+/* Trace file formats */
+#define TEXT_TRACE  0
+#define BIN_TRACE   1
+#define PACK_TRACE  2
+
+/* Streamed replay (-F) */
+#define STREAM_CHUNK  (1<<20) /* bytes read at a time from a streamed trace */
+#define SLOTS_MIN        1024 /* smallest live-slot table (a power of 2) */
+
+/* Batch benchmark */
+#define BATCH_ROUNDS  16 /* batches allocated and freed per timed run */
+#define RSS_SAMPLE    64 /* ops between two samples of the resident heap */
+
+/* Thread stress test (-T), in the driver built with -DTHREAD_SAFE */
+#define STRESS_OPS     100000 /* requests per thread */
+#define STRESS_SLOTS      256 /* live blocks per thread */
+#define STRESS_QUEUE       64 /* blocks handed over to a thread at most */
+#define STRESS_DRAIN       32 /* requests between two drains of the queue */
+#define STRESS_BATCH       16 /* blocks of a batch */
+#define STRESS_BATCH_EVERY 1024 /* requests between two batches */
+#define STRESS_HUGE   (1<<19) /* max size of a huge request */
+#define STRESS_ALIGN       64 /* alignment of a memalign request */
+
+/* Arena mode, flags of a trace op */
+#define ARENA_NEW      1 /* the new block is allocated in the phase arena */
+#define ARENA_OLD      2 /* the block freed or queried is in the arena */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
+
+/* Shadow bitmap, one bit per ALIGNMENT-byte granule of the heap */
+#define SHADOW_BITS    (8 * sizeof(unsigned long))
+#define GRANULE(p)     ((size_t)((char *)(p) - (char *)mem_heap_lo()) / ALIGNMENT)
+#define IN_SHADOW(p)   (((char *)(p) >= (char *)mem_heap_lo()) && \
+			(GRANULE(p) / SHADOW_BITS < shadow_words))
+
+/* Payload patterns, the 8-byte word k of the payload of block index 
+ * holds PATTERN_SEED(index) + k * PATTERN_STEP, so that every offset of a 
+ * payload holds a different byte */
+#define PATTERN_SEED(index) (((pword_t)(index) + 1) * 0x9E3779B97F4A7C15ULL)
+#define PATTERN_STEP        0xD6E8FEB86659FD93ULL
+
+/* True if the payload of block index is filled and checked (see -S) */
+#define SAMPLED(index) \
+    ((((unsigned)(index) * 2654435761U) >> 8) % sample_every == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* A word of a payload pattern */
+typedef unsigned long long pword_t;
+
+/* Records the extent of each block's payload outside the heap */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
@@ -46,9 +123,13 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC,
+	  CALLOC, MEMALIGN, USABLE} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    int size;                         /* byte size of alloc/realloc request,
+					 or of the block to free */
+    int align;                        /* alignment of a memalign request */
+    int arena;                        /* ARENA_NEW/ARENA_OLD flags (-A) */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -60,8 +141,109 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file, or NULL */
+    size_t map_size;     /* bytes mapped */
 } trace_t;
 
+/* 
+ * Header of a binary trace file. It is followed by the num_ops requests 
+ * as traceop_t records, so that a mapping of the file is used as the 
+ * request array as it is. The file is written by mdriver -C, and can 
+ * only be read by an mdriver of the same byte order and traceop_t layout.
+ * A packed trace file has the same header, with PACK_MAGIC and an 
+ * op_size of 0, followed by the packed requests (see pack_op).
+ */
+typedef struct {
+    char magic[8];       /* BIN_MAGIC */
+    int order;           /* BIN_ORDER as written */
+    int op_size;         /* sizeof(traceop_t) as written */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+} binhdr_t;
+
+/* The state of the encoder or the decoder of a packed trace */
+typedef struct {
+    int recent[PACK_RECENT]; /* the ids deltas are taken from */
+    int next;            /* entry of recent replaced next */
+    int size;            /* last size coded */
+} pack_t;
+
+/* 
+ * A trace replayed as it is read (-F), in any format. The file is read 
+ * in chunks into two buffers in turn: requests are decoded from one 
+ * buffer while the kernel reads the next chunk ahead, and the bytes of 
+ * a request cut by the end of a chunk are carried to the front of the 
+ * other buffer. Only the two buffers are held, whatever the trace size.
+ */
+typedef struct {
+    int fd;
+    char *path;
+    int format;          /* TEXT_TRACE, BIN_TRACE or PACK_TRACE */
+    pack_t pack;         /* decoder state of a packed trace */
+    char *buf[2];        /* STREAM_CHUNK + MAXLINE + 1 bytes each */
+    int cur;             /* buffer being decoded */
+    char *pos;           /* next byte to decode in it */
+    char *end;           /* end of the bytes read into it */
+    off_t off;           /* file offset of the next chunk */
+    int eof;             /* the whole file has been read */
+    int num_ops;         /* number of requests given by the header */
+} stream_t;
+
+/* A live block of a streamed trace */
+typedef struct {
+    int id;              /* trace id, -1 if the slot is empty */
+    int size;            /* payload size, grown by mm_usable_size */
+    int req;             /* size requested, for the utilization */
+    char *p;             /* payload */
+} slot_t;
+
+/* 
+ * The live blocks of a streamed trace by id, with open addressing and 
+ * linear probing. The table is kept between 1/8 and 3/4 full, so that 
+ * its size follows the number of live blocks rather than the number of 
+ * ids in the trace.
+ */
+typedef struct {
+    slot_t *slots;
+    size_t mask;         /* number of slots - 1 */
+    size_t live;         /* slots in use */
+    size_t peak;         /* largest number of slots */
+} slots_t;
+
+#ifdef THREAD_SAFE
+/* A live block of the stress test and the seed of its pattern */
+typedef struct {
+    char *p;
+    int size;
+    pword_t seed;
+} sblock_t;
+
+/* 
+ * One thread of the stress test (-T). A part of its blocks are handed 
+ * over to the next thread, which frees them, so that blocks are freed 
+ * by other threads than the one that allocated them.
+ */
+typedef struct stress_t {
+    int id;
+    pthread_t tid;
+    unsigned rand;          /* state of its xorshift generator */
+    unsigned blocks;        /* blocks allocated so far, for the seeds */
+    int errors;             /* errors found by its checks */
+    struct stress_t *next;  /* thread its blocks are handed over to */
+    pthread_mutex_t lock;   /* guards queue and passed */
+    sblock_t queue[STRESS_QUEUE]; /* blocks handed over to it */
+    int passed;             /* number of blocks in queue */
+} stress_t;
+
+/* Holds the params to eval_threads_run, which is timed by ftimer */
+typedef struct {
+    stress_t *threads;
+    int n;
+} stress_params_t;
+#endif
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,6 +254,14 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Holds the params to eval_batch_speed, one size of the batch benchmark */
+typedef struct {
+    int size;     /* byte size of every block */
+    int n;        /* number of blocks per batch */
+    int batch;    /* use mm_malloc_batch/mm_free_batch rather than one by one */
+    void **ptrs;  /* the blocks of the current batch */
+} batch_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,17 +271,45 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double peak;     /* largest heap size in bytes during the trace */
+    double final;    /* heap size in bytes at the end of the trace */
+    double rss;      /* mean resident heap in bytes, sampled */
+    double purged;   /* resident heap pages purged */
+    double refaulted;/* purged heap pages faulted in again */
+    double maps;     /* huge blocks mapped outside the heap */
+    double remapped; /* bytes moved by remapping instead of copying */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Holds the params to eval_mm_stream, which is timed by ftimer */
+typedef struct {
+    char *path;          /* the streamed trace */
+    range_t **ranges;
+    stats_t *stats;
+    int valid;           /* set if the trace ran without errors */
+    size_t peak_live;    /* largest number of live blocks */
+    size_t peak_slots;   /* largest size of the live-slot table */
+} stream_params_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int sized_free = 0; /* free with mm_free_sized (set by -s) */
+static int arena_phase = 0; /* ops per arena phase, 0 if off (set by -A) */
+static int sample_every = 1; /* check one payload in n (set by -S) */
+
+/* The shadow bitmap of the heap, a set bit marks an allocated payload */
+static unsigned long *shadow = NULL;
+static size_t shadow_words = 0; /* words covering the max heap */
+static size_t shadow_used = 0;  /* words that may have a bit set */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Request sizes of the batch benchmark, 0-terminated */
+static int batch_sizes[] = {16, 64, 100, 240, 1000, 0};
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -105,15 +323,45 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range lists and the shadow bitmap */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
+static void remove_range(range_t **ranges, char *lo, int size);
 static void clear_ranges(range_t **ranges);
+static void shadow_init(size_t max_heap);
+static size_t shadow_find(size_t g0, size_t g1);
+static void shadow_fill(size_t g0, size_t g1, int set);
+
+/* these functions fill and check payload patterns */
+static void fill_pattern(char *p, size_t size, pword_t seed, pword_t step);
+static size_t check_pattern(char *p, size_t size, pword_t seed, pword_t step);
+static void fill_block(char *p, int index, size_t size);
+static size_t check_block(char *p, int index, size_t size);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static trace_t *map_trace(char *path, FILE *tracefile);
+static trace_t *unpack_trace(char *path, FILE *tracefile);
+static void write_trace(trace_t *trace, char *path);
+static void pack_init(pack_t *pk);
+static int pack_op(pack_t *pk, traceop_t *op, unsigned char *out);
+static unsigned char *unpack_op(pack_t *pk, unsigned char *in, traceop_t *op);
+static unsigned char *put_varint(unsigned char *p, unsigned v);
+static unsigned char *get_varint(unsigned char *p, unsigned *v);
 static void free_trace(trace_t *trace);
+static void mark_arena_ops(trace_t *trace, int phase);
+
+/* these functions stream a trace and keep its live blocks by id */
+static void stream_open(stream_t *s, char *path);
+static size_t stream_fill(stream_t *s);
+static char *stream_line(stream_t *s);
+static int stream_next(stream_t *s, traceop_t *op);
+static void stream_close(stream_t *s);
+static size_t slot_home(slots_t *t, int id);
+static void slots_resize(slots_t *t, size_t n);
+static slot_t *slot_find(slots_t *t, int id);
+static slot_t *slot_add(slots_t *t, int id);
+static void slot_remove(slots_t *t, slot_t *slot);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -121,10 +369,38 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 stats_t *stats);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats);
 static void eval_mm_speed(void *ptr);
 
+/* Runs the batch benchmark of mm_malloc_batch and mm_free_batch */
+static int eval_batch_valid(batch_t *params, int sizenum, range_t **ranges);
+static void eval_batch_speed(void *ptr);
+static void eval_batch(int n, range_t **ranges);
+
+/* these functions replay a streamed trace */
+static int eval_stream_op(traceop_t *op, int opnum, slots_t *t,
+			  range_t **ranges, double *total_size);
+static void eval_mm_stream(void *ptr);
+static void eval_stream(char *path, range_t **ranges);
+
+#ifdef THREAD_SAFE
+/* these functions run the thread stress test */
+static unsigned stress_rand(stress_t *t);
+static int stress_size(stress_t *t);
+static int stress_check(stress_t *t, sblock_t *b, char *what);
+static int stress_new(stress_t *t, sblock_t *b);
+static void stress_free(stress_t *t, sblock_t *b);
+static void stress_pass(stress_t *t, sblock_t *b);
+static void stress_drain(stress_t *t);
+static void stress_batch(stress_t *t);
+static void *stress_thread(void *arg);
+static void eval_threads_run(void *ptr);
+static void eval_threads(int n);
+#endif
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
 static void usage(void);
@@ -150,6 +426,11 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int batch_n = 0;     /* If set, run the batch benchmark (set by -b) */
+    size_t max_heap = MAX_HEAP;  /* Max heap size in bytes (set by -H) */
+    char *conv_file = NULL; /* If set, convert the -f trace to it (-C) */
+    char *stream_file = NULL; /* If set, stream this trace only (-F) */
+    int threads_n = 0;   /* If set, run the thread stress test (set by -T) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +439,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:b:H:A:S:C:F:T:hvVgals")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +459,52 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'b': /* Run the batch benchmark with batches of n blocks */
+            if ((batch_n = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'H': /* Max heap size in MB */
+            if (atoi(optarg) <= 0) {
+		usage();
+		exit(1);
+	    }
+            max_heap = (size_t)atoi(optarg) << 20;
+            break;
+        case 'F': /* Stream one trace file with bounded memory */
+            stream_file = strdup(optarg);
+            break;
+        case 'C': /* Convert the -f trace to another trace file */
+            conv_file = strdup(optarg);
+            break;
+        case 'S': /* Fill and check only one payload in n */
+            if ((sample_every = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'A': /* Replay the traces with an arena reset every n ops */
+            if ((arena_phase = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'T': /* Run the stress test with n threads */
+            if ((threads_n = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 's': /* Free blocks with mm_free_sized */
+            sized_free = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +520,20 @@ int main(int argc, char **argv)
         }
     }
 	
+    /*
+     * Converting a trace replaces the runs
+     */
+    if (conv_file != NULL) {
+	if (num_tracefiles != 1) {
+	    usage();
+	    exit(1);
+	}
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, conv_file);
+	free_trace(trace);
+	exit(0);
+    }
+
     /* 
      * Check and print team info 
      */
@@ -225,6 +560,41 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+ 
+    /*
+     * The batch benchmark replaces the trace runs
+     */
+    if (batch_n) {
+	init_fsecs();
+	mem_init_size(max_heap);
+	shadow_init(max_heap);
+	eval_batch(batch_n, &ranges);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * So does a streamed trace
+     */
+    if (stream_file != NULL) {
+	mem_init_size(max_heap);
+	shadow_init(max_heap);
+	eval_stream(stream_file, &ranges);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * And so does the thread stress test
+     */
+    if (threads_n) {
+#ifdef THREAD_SAFE
+	mem_init_size(max_heap);
+	eval_threads(threads_n);
+	exit(errors ? 1 : 0);
+#else
+	app_error("-T needs the thread-safe driver (make threaded)");
+#endif
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -285,19 +655,22 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    mem_init_size(max_heap); 
+    shadow_init(max_heap);
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
+	if (arena_phase)
+	    mark_arena_ops(trace, arena_phase);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges, &mm_stats[i]);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i]);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
@@ -367,22 +740,28 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
- * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * The following routines keep track of the extent of every allocated 
+ * block payload, to detect any overlapping allocated blocks. Payloads 
+ * in the heap are marked in the shadow bitmap, at one bit per 
+ * ALIGNMENT-byte granule, so that a check costs a few word operations 
+ * instead of a walk over every live block. Since payloads are aligned, 
+ * two payloads overlap if and only if they share a granule. The few 
+ * payloads in blocks mapped outside the heap are kept in the range list.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we mark it in the shadow bitmap, or create a range struct for 
+ *     it and add it to the range list if it is outside the heap. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    size_t g;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -395,9 +774,11 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or in a block
+     * mapped on its own */
+    if (!mem_is_mapped(lo, hi) &&
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -405,6 +786,16 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
+    if (IN_SHADOW(lo)) {
+	if ((g = shadow_find(GRANULE(lo), GRANULE(hi))) != (size_t)-1) {
+	    sprintf(msg, "Payload (%p:%p) overlaps another payload at %p\n",
+		    lo, hi, (char *)mem_heap_lo() + g * ALIGNMENT);
+	    malloc_error(tracenum, opnum, msg);
+	    return 0;
+	}
+	shadow_fill(GRANULE(lo), GRANULE(hi), 1);
+	return 1;
+    }
     for (p = *ranges;  p != NULL;  p = p->next) {
         if ((lo >= p->lo && lo <= p-> hi) ||
             (hi >= p->lo && hi <= p->hi)) {
@@ -429,18 +820,21 @@ static int add_range(range_t **ranges, char *lo, int size,
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - Clear the shadow bits of the block of size bytes whose 
+ *     payload starts at lo, or free its range record
  */
-static void remove_range(range_t **ranges, char *lo)
+static void remove_range(range_t **ranges, char *lo, int size)
 {
     range_t *p;
     range_t **prevpp = ranges;
-    int size;
 
+    if (IN_SHADOW(lo)) {
+	shadow_fill(GRANULE(lo), GRANULE(lo + size - 1), 0);
+	return;
+    }
     for (p = *ranges;  p != NULL; p = p->next) {
         if (p->lo == lo) {
 	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
             free(p);
             break;
         }
@@ -449,7 +843,8 @@ static void remove_range(range_t **ranges, char *lo)
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - free all of the range records and clear the shadow 
+ *     bitmap for a trace 
  */
 static void clear_ranges(range_t **ranges)
 {
@@ -461,8 +856,174 @@ static void clear_ranges(range_t **ranges)
         free(p);
     }
     *ranges = NULL;
+
+    memset(shadow, 0, shadow_used * sizeof(unsigned long));
+    shadow_used = 0;
+}
+
+/*
+ * shadow_init - Allocate the shadow bitmap for a heap of up to max_heap 
+ *     bytes
+ */
+static void shadow_init(size_t max_heap)
+{
+    shadow_words = (max_heap / ALIGNMENT + SHADOW_BITS - 1) / SHADOW_BITS;
+    if ((shadow = calloc(shadow_words, sizeof(unsigned long))) == NULL)
+	unix_error("calloc failed in shadow_init");
+    shadow_used = 0;
+}
+
+/*
+ * shadow_find - Return the first set granule in g0..g1, or (size_t)-1 
+ *     if none is, scanning a word of granules at a time
+ */
+static size_t shadow_find(size_t g0, size_t g1)
+{
+    size_t w, w1 = g1 / SHADOW_BITS;
+    unsigned long bits;
+
+    for (w = g0 / SHADOW_BITS; w <= w1; w++) {
+	bits = shadow[w];
+	if (w == g0 / SHADOW_BITS)
+	    bits &= ~0UL << (g0 % SHADOW_BITS);
+	if (w == w1)
+	    bits &= ~0UL >> (SHADOW_BITS - 1 - g1 % SHADOW_BITS);
+	if (bits)
+	    return w * SHADOW_BITS + __builtin_ctzl(bits);
+    }
+    return (size_t)-1;
+}
+
+/*
+ * shadow_fill - Set (or clear) the granules g0..g1, a word at a time
+ */
+static void shadow_fill(size_t g0, size_t g1, int set)
+{
+    size_t w, w1 = g1 / SHADOW_BITS;
+    unsigned long mask;
+
+    assert(w1 < shadow_words);
+    for (w = g0 / SHADOW_BITS; w <= w1; w++) {
+	mask = ~0UL;
+	if (w == g0 / SHADOW_BITS)
+	    mask &= ~0UL << (g0 % SHADOW_BITS);
+	if (w == w1)
+	    mask &= ~0UL >> (SHADOW_BITS - 1 - g1 % SHADOW_BITS);
+	if (set)
+	    shadow[w] |= mask;
+	else
+	    shadow[w] &= ~mask;
+    }
+    if (set && (w1 >= shadow_used))
+	shadow_used = w1 + 1;
+}
+
+
+/*****************************************************************
+ * The following routines fill payloads with their patterns and check 
+ * that a payload still holds its pattern, 32 (AVX2) or 16 (SSE2) bytes 
+ * at a time when built for it, and a word at a time otherwise.
+ ****************************************************************/
+
+/*
+ * fill_pattern - Fill the size bytes at p (8-byte aligned) with the 
+ *     pattern whose word k is seed + k * step
+ */
+static void fill_pattern(char *p, size_t size, pword_t seed, pword_t step)
+{
+    size_t k = 0, n = size / 8;
+    pword_t w;
+#if defined(__AVX2__)
+    __m256i v = _mm256_set_epi64x(seed + 3*step, seed + 2*step, 
+				  seed + step, seed);
+    __m256i inc = _mm256_set1_epi64x(4*step);
+
+    for (; k + 4 <= n; k += 4) {
+	_mm256_storeu_si256((__m256i *)(p + 8*k), v);
+	v = _mm256_add_epi64(v, inc);
+    }
+#elif defined(__SSE2__)
+    __m128i v = _mm_set_epi64x(seed + step, seed);
+    __m128i inc = _mm_set1_epi64x(2*step);
+
+    for (; k + 2 <= n; k += 2) {
+	_mm_storeu_si128((__m128i *)(p + 8*k), v);
+	v = _mm_add_epi64(v, inc);
+    }
+#endif
+    for (; k < n; k++) {
+	w = seed + k*step;
+	memcpy(p + 8*k, &w, 8);
+    }
+    w = seed + n*step;
+    memcpy(p + 8*n, &w, size % 8);
+}
+
+/*
+ * check_pattern - Return the offset of the first of the size bytes at p 
+ *     that does not hold the pattern of fill_pattern, or size if all do
+ */
+static size_t check_pattern(char *p, size_t size, pword_t seed, pword_t step)
+{
+    size_t k = 0, n = size / 8, j;
+    pword_t w;
+#if defined(__AVX2__)
+    __m256i v = _mm256_set_epi64x(seed + 3*step, seed + 2*step, 
+				  seed + step, seed);
+    __m256i inc = _mm256_set1_epi64x(4*step);
+
+    for (; k + 4 <= n; k += 4) {
+	if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		_mm256_loadu_si256((__m256i *)(p + 8*k)), v)) != -1)
+	    break;
+	v = _mm256_add_epi64(v, inc);
+    }
+#elif defined(__SSE2__)
+    __m128i v = _mm_set_epi64x(seed + step, seed);
+    __m128i inc = _mm_set1_epi64x(2*step);
+
+    for (; k + 2 <= n; k += 2) {
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_loadu_si128((__m128i *)(p + 8*k)), v)) != 0xFFFF)
+	    break;
+	v = _mm_add_epi64(v, inc);
+    }
+#endif
+    for (; k < n; k++) {
+	w = seed + k*step;
+	if (memcmp(p + 8*k, &w, 8) != 0)
+	    break;
+    }
+    /* the rest, or the word holding the first mismatch, byte by byte */
+    for (j = 8*k; j < size; j++) {
+	w = seed + (j / 8)*step;
+	if ((unsigned char)p[j] != (unsigned char)(w >> (8 * (j % 8))))
+	    return j;
+    }
+    return size;
+}
+
+/*
+ * fill_block - Fill the payload of block index with its pattern, if it 
+ *     is sampled
+ */
+static void fill_block(char *p, int index, size_t size)
+{
+    if (SAMPLED(index))
+	fill_pattern(p, size, PATTERN_SEED(index), PATTERN_STEP);
 }
 
+/*
+ * check_block - Return the offset of the first byte of the payload of 
+ *     block index that does not hold its pattern, or size if all do or 
+ *     if the block is not sampled
+ */
+static size_t check_block(char *p, int index, size_t size)
+{
+    if (!SAMPLED(index))
+	return size;
+    return check_pattern(p, size, PATTERN_SEED(index), PATTERN_STEP);
+}
 
 /**********************************************
  * The following routines manipulate tracefiles
@@ -470,6 +1031,10 @@ static void clear_ranges(range_t **ranges)
 
 /*
  * read_trace - read a trace file and store it in memory
+ *   Besides "a id size", "r id size" and "f id" requests, a trace may
+ *   contain "c id size" (calloc), "m id alignment size" (memalign) and
+ *   "u id" (usable size query) requests. A binary trace file (see
+ *   binhdr_t) is mapped instead, and a packed trace file is decoded.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -477,24 +1042,35 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
     strcpy(path, tracedir);
     strcat(path, filename);
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+
+    /* A binary or packed trace starts with its magic */
+    if (fread(type, 1, 8, tracefile) == 8) {
+	if (memcmp(type, BIN_MAGIC, 8) == 0)
+	    return map_trace(path, tracefile);
+	if (memcmp(type, PACK_MAGIC, 8) == 0)
+	    return unpack_trace(path, tracefile);
+    }
+    rewind(tracefile);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+
+    /* Read the trace file header */
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -519,6 +1095,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	/* the fields a request does not use are zero, as write_trace
+	 * dumps them */
+	memset(&trace->ops[op_index], 0, sizeof(traceop_t));
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
@@ -538,12 +1117,36 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = trace->block_sizes[index];
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &align, &size);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = align;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'u':
+	    fscanf(tracefile, "%u", &index);
+	    trace->ops[op_index].type = USABLE;
+	    trace->ops[op_index].index = index;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
 	    exit(1);
 	}
+	if (trace->ops[op_index].type != FREE && 
+	    trace->ops[op_index].type != USABLE)
+	    trace->block_sizes[index] = size; /* for a later sized free */
 	op_index++;
 	
     }
@@ -555,111 +1158,824 @@ static trace_t *read_trace(char *tracedir, char *filename)
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * map_trace - map the binary trace file at path (open as tracefile), its
+ *   records are the request array. The mapping is private, so that the
+ *   requests can still be marked (see mark_arena_ops).
  */
-void free_trace(trace_t *trace)
+static trace_t *map_trace(char *path, FILE *tracefile)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
+    trace_t *trace;
+    binhdr_t *hdr;
+    traceop_t *op;
+    struct stat st;
+    int i;
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in map_trace");
+
+    if (fstat(fileno(tracefile), &st) < 0)
+	unix_error("fstat failed in map_trace");
+    if ((size_t)st.st_size < sizeof(binhdr_t)) {
+	sprintf(msg, "Truncated binary trace %s", path);
+	app_error(msg);
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE, fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    fclose(tracefile);
+
+    hdr = trace->map;
+    if ((hdr->order != BIN_ORDER) || (hdr->op_size != sizeof(traceop_t))) {
+	sprintf(msg, "Binary trace %s was written with another byte order "
+		"or request layout", path);
+	app_error(msg);
+    }
+    if ((hdr->num_ops < 0) || (hdr->num_ids <= 0) || (trace->map_size !=
+	 sizeof(binhdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t))) {
+	sprintf(msg, "Bad size of binary trace %s", path);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+
+    /* the requests are used as they are, but must not index out of the
+     * block arrays */
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if ((op->type < ALLOC) || (op->type > USABLE) || (op->index < 0) ||
+	    (op->index >= trace->num_ids) || (op->size < 0)) {
+	    sprintf(msg, "Bad request %d in binary trace %s", i, path);
+	    app_error(msg);
+	}
+    }
+
+    if ((trace->blocks =
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes =
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+
+    return trace;
+}
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * unpack_trace - read the packed trace file at path (open as tracefile)
+ *   and decode its requests into the request array
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static trace_t *unpack_trace(char *path, FILE *tracefile)
 {
-    int i, j;
-    int index;
-    int size;
-    int oldsize;
-    char *newp;
-    char *oldp;
-    char *p;
-    
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
-    clear_ranges(ranges);
+    trace_t *trace;
+    binhdr_t hdr;
+    pack_t pk;
+    traceop_t *op;
+    struct stat st;
+    unsigned char *buf, *p, *end;
+    size_t size;
+    int i;
 
-    /* Call the mm package's init function */
-    if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
-	return 0;
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in unpack_trace");
+    trace->map = NULL;
+
+    rewind(tracefile);
+    if (fstat(fileno(tracefile), &st) < 0)
+	unix_error("fstat failed in unpack_trace");
+    if (((size_t)st.st_size < sizeof(binhdr_t)) ||
+	(fread(&hdr, sizeof(hdr), 1, tracefile) != 1)) {
+	sprintf(msg, "Truncated packed trace %s", path);
+	app_error(msg);
+    }
+    if ((hdr.order != BIN_ORDER) || (hdr.op_size != 0)) {
+	sprintf(msg, "Packed trace %s was written with another byte order",
+		path);
+	app_error(msg);
+    }
+    if ((hdr.num_ops < 0) || (hdr.num_ids <= 0)) {
+	sprintf(msg, "Bad header in packed trace %s", path);
+	app_error(msg);
     }
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+
+    /* the requests are read at once, the padding lets unpack_op run past
+     * the end of a truncated file */
+    size = st.st_size - sizeof(hdr);
+    if ((buf = calloc(size + PACK_MAXOP, 1)) == NULL)
+	unix_error("calloc failed in unpack_trace");
+    if (fread(buf, 1, size, tracefile) != size)
+	unix_error("fread failed in unpack_trace");
+    fclose(tracefile);
 
-    /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    if ((trace->ops =
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in unpack_trace");
+    if ((trace->blocks =
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in unpack_trace");
+    if ((trace->block_sizes =
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in unpack_trace");
+
+    pack_init(&pk);
+    end = buf + size;
+    for (i = 0, p = buf; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	p = unpack_op(&pk, p, op);
+	if ((p > end) || (op->type > USABLE) || (op->index < 0) ||
+	    (op->index >= trace->num_ids) || (op->size < 0)) {
+	    sprintf(msg, "Bad request %d in packed trace %s", i, path);
+	    app_error(msg);
+	}
 
-        switch (trace->ops[i].type) {
+	/* a free gets the size of its block, as in read_trace */
+	if (op->type == FREE)
+	    op->size = trace->block_sizes[op->index];
+	else if (HAS_SIZE(op->type))
+	    trace->block_sizes[op->index] = op->size;
+    }
+    if (p != end) {
+	sprintf(msg, "Bad size of packed trace %s", path);
+	app_error(msg);
+    }
 
-        case ALLOC: /* mm_malloc */
+    free(buf);
+    return trace;
+}
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
-		return 0;
+/*
+ * write_trace - Write the trace to path: as a text trace if path ends
+ *   in ".rep", as a packed trace if it ends in ".rz", and else as a
+ *   binary trace.
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+    FILE *file;
+    binhdr_t hdr;
+    pack_t pk;
+    traceop_t *op;
+    unsigned char buf[PACK_MAXOP];
+    size_t len = strlen(path);
+    int i, n;
+    int ok = 1;
+    int format = BIN_TRACE;
+
+    if ((len >= 4) && (strcmp(path + len - 4, ".rep") == 0))
+	format = TEXT_TRACE;
+    else if ((len >= 3) && (strcmp(path + len - 3, ".rz") == 0))
+	format = PACK_TRACE;
+
+    if ((file = fopen(path, "wb")) == NULL) {
+	sprintf(msg, "Could not open %s in write_trace", path);
+	unix_error(msg);
+    }
+
+    if (format == TEXT_TRACE) {
+	fprintf(file, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize,
+		trace->num_ids, trace->num_ops, trace->weight);
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    fprintf(file, "%c %d", "afrcmu"[op->type], op->index);
+	    if (op->type == MEMALIGN)
+		fprintf(file, " %d", op->align);
+	    if (HAS_SIZE(op->type))
+		fprintf(file, " %d", op->size);
+	    fputc('\n', file);
+	}
+    }
+    else {
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, (format == PACK_TRACE) ? PACK_MAGIC : BIN_MAGIC, 8);
+	hdr.order = BIN_ORDER;
+	hdr.op_size = (format == PACK_TRACE) ? 0 : sizeof(traceop_t);
+	hdr.sugg_heapsize = trace->sugg_heapsize;
+	hdr.num_ids = trace->num_ids;
+	hdr.num_ops = trace->num_ops;
+	hdr.weight = trace->weight;
+	ok = (fwrite(&hdr, sizeof(hdr), 1, file) == 1);
+
+	if (format == PACK_TRACE) {
+	    pack_init(&pk);
+	    for (i = 0; ok && (i < trace->num_ops); i++) {
+		n = pack_op(&pk, &trace->ops[i], buf);
+		ok = (fwrite(buf, 1, n, file) == (size_t)n);
 	    }
-	    
-	    /* 
-	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
-	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
-		return 0;
-	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
-	    memset(p, index & 0xFF, size);
+	}
+	else if (ok)
+	    ok = (fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, file) ==
+		  (size_t)trace->num_ops);
+    }
 
-	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
-	    break;
+    if (ferror(file) || (fclose(file) != 0) || !ok) {
+	sprintf(msg, "Could not write %s in write_trace", path);
+	unix_error(msg);
+    }
+}
 
-        case REALLOC: /* mm_realloc */
-	    
-	    /* Call the student's realloc */
-	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
-		return 0;
-	    }
-	    
-	    /* Remove the old region from the range list */
-	    remove_range(ranges, oldp);
-	    
+/*
+ * pack_init - the state of an encoder or decoder at the start of a trace
+ */
+static void pack_init(pack_t *pk)
+{
+    int k;
+
+    for (k = 0; k < PACK_RECENT; k++)
+	pk->recent[k] = -1;
+    pk->next = 0;
+    pk->size = 0;
+}
+
+/*
+ * pack_op - Encode op into out and return its length, at most PACK_MAXOP
+ *   bytes. A packed request is a tag byte, with the type in bits 0-2 and
+ *   the recent id nearest to the id in bits 3-5, then the zigzag varint
+ *   delta of the id from that recent id, unless PACK_SAME_ID, then the
+ *   varint size, unless HAS_SIZE is false or PACK_SAME_SIZE, and the
+ *   varint alignment of a memalign. An id that is not a recent one
+ *   replaces the oldest.
+ */
+static int pack_op(pack_t *pk, traceop_t *op, unsigned char *out)
+{
+    unsigned char *p = out + 1;
+    unsigned delta;
+    int k, best = 0;
+    int tag = op->type;
+
+    for (k = 1; k < PACK_RECENT; k++)
+	if (ZIGZAG(op->index - pk->recent[k]) <
+	    ZIGZAG(op->index - pk->recent[best]))
+	    best = k;
+    delta = (unsigned)op->index - (unsigned)pk->recent[best];
+    tag |= best << 3;
+    if (delta == 0)
+	tag |= PACK_SAME_ID;
+    else {
+	p = put_varint(p, ZIGZAG(delta));
+	pk->recent[pk->next] = op->index;
+	pk->next = (pk->next + 1) % PACK_RECENT;
+    }
+
+    if (HAS_SIZE(op->type)) {
+	if (op->size == pk->size)
+	    tag |= PACK_SAME_SIZE;
+	else {
+	    p = put_varint(p, op->size);
+	    pk->size = op->size;
+	}
+    }
+    if (op->type == MEMALIGN)
+	p = put_varint(p, op->align);
+
+    out[0] = tag;
+    return p - out;
+}
+
+/*
+ * unpack_op - Decode the packed request at in into op, and return the
+ *   byte after it. The request must be followed by PACK_MAXOP readable
+ *   bytes if it may be cut.
+ */
+static unsigned char *unpack_op(pack_t *pk, unsigned char *in, traceop_t *op)
+{
+    int tag = *in++;
+    unsigned v;
+
+    op->type = tag & 7;
+    op->index = pk->recent[(tag >> 3) & 7];
+    op->size = 0;
+    op->align = 0;
+    op->arena = 0;
+
+    if (!(tag & PACK_SAME_ID)) {
+	in = get_varint(in, &v);
+	op->index = (unsigned)op->index + UNZIGZAG(v);
+	pk->recent[pk->next] = op->index;
+	pk->next = (pk->next + 1) % PACK_RECENT;
+    }
+
+    if (HAS_SIZE(op->type)) {
+	if (!(tag & PACK_SAME_SIZE)) {
+	    in = get_varint(in, &v);
+	    pk->size = v;
+	}
+	op->size = pk->size;
+    }
+    if (op->type == MEMALIGN) {
+	in = get_varint(in, &v);
+	op->align = v;
+    }
+    return in;
+}
+
+/*
+ * put_varint - write v at p, 7 bits a byte from the lowest, with the top
+ *   bit set in every byte but the last. return the byte after it
+ */
+static unsigned char *put_varint(unsigned char *p, unsigned v)
+{
+    while (v >= 0x80) {
+	*p++ = v | 0x80;
+	v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/*
+ * get_varint - read the varint at p into v, at most 5 bytes. return the
+ *   byte after it
+ */
+static unsigned char *get_varint(unsigned char *p, unsigned *v)
+{
+    unsigned x = 0;
+    int shift;
+
+    for (shift = 0; (shift < 28) && (*p & 0x80); shift += 7)
+	x |= (unsigned)(*p++ & 0x7f) << shift;
+    *v = x | ((unsigned)*p++ << shift);
+    return p;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the requests of a binary trace.
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * mark_arena_ops - For the arena mode (-A), the trace is cut into phases
+ *   of phase ops, and the arena is reset at the start of every phase. A
+ *   block allocated by mm_malloc and freed in the same phase is allocated
+ *   in the arena (ARENA_NEW), and the ops on it are flagged ARENA_OLD, so
+ *   that it is never passed to mm_free or mm_usable_size. The blocks
+ *   that are reallocated stay out of the arena.
+ */
+static void mark_arena_ops(trace_t *trace, int phase)
+{
+    int i;
+    int *born;      /* op that allocated the current block of each id */
+    traceop_t *op;
+
+    if ((born = malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc failed in mark_arena_ops");
+    for (i = 0;  i < trace->num_ids;  i++)
+	born[i] = -1;
+
+    /* the blocks that are freed in the phase they were allocated in */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->ops[i];
+	op->arena = 0;
+	if ((op->type == FREE) && (born[op->index] >= 0) && 
+	    (born[op->index] / phase == i / phase))
+	    trace->ops[born[op->index]].arena = ARENA_NEW;
+	if ((op->type != FREE) && (op->type != USABLE))
+	    born[op->index] = (op->type == ALLOC) ? i : -1;
+    }
+
+    /* the ops on them */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->ops[i];
+	if ((op->type == FREE) || (op->type == USABLE))
+	    op->arena = born[op->index];
+	else
+	    born[op->index] = (op->arena & ARENA_NEW) ? ARENA_OLD : 0;
+    }
+
+    free(born);
+}
+
+/*****************************************************************
+ * The following routines read a trace while it is replayed (-F),
+ * and keep the live blocks of a streamed trace in a table by id.
+ ****************************************************************/
+
+/*
+ * stream_open - open the trace at path for streaming and read its header
+ */
+static void stream_open(stream_t *s, char *path)
+{
+    binhdr_t hdr;
+    char *line;
+    int i;
+
+    s->path = path;
+    if ((s->fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in stream_open", path);
+	unix_error(msg);
+    }
+    posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (i = 0; i < 2; i++)
+	if ((s->buf[i] = malloc(STREAM_CHUNK + MAXLINE + 1)) == NULL)
+	    unix_error("malloc failed in stream_open");
+    s->cur = 0;
+    s->pos = s->end = s->buf[0];
+    s->off = 0;
+    s->eof = 0;
+    stream_fill(s);
+
+    /* A binary or packed trace starts with its magic */
+    s->format = TEXT_TRACE;
+    if (s->end - s->pos >= 8) {
+	if (memcmp(s->pos, BIN_MAGIC, 8) == 0)
+	    s->format = BIN_TRACE;
+	else if (memcmp(s->pos, PACK_MAGIC, 8) == 0)
+	    s->format = PACK_TRACE;
+    }
+    if (s->format != TEXT_TRACE) {
+	if (s->end - s->pos < sizeof(binhdr_t)) {
+	    sprintf(msg, "Truncated trace %s", path);
+	    app_error(msg);
+	}
+	memcpy(&hdr, s->pos, sizeof(hdr));
+	if ((hdr.order != BIN_ORDER) || (hdr.op_size !=
+	     ((s->format == BIN_TRACE) ? sizeof(traceop_t) : 0))) {
+	    sprintf(msg, "Trace %s was written with another byte "
+		    "order or request layout", path);
+	    app_error(msg);
+	}
+	s->num_ops = hdr.num_ops;
+	s->pos += sizeof(hdr);
+	pack_init(&s->pack);
+	return;
+    }
+
+    /* The text header has one number a line, the third one is num_ops */
+    for (i = 0; i < HDRLINES; i++) {
+	if ((line = stream_line(s)) == NULL) {
+	    sprintf(msg, "Truncated header in tracefile %s", path);
+	    app_error(msg);
+	}
+	if (i == 2)
+	    s->num_ops = atoi(line);
+    }
+}
+
+/*
+ * stream_fill - Carry the bytes left in the current buffer to the front
+ *   of the other one, read the next chunk behind them and make that
+ *   buffer current. The kernel is asked to read the chunk after it
+ *   ahead, while this one is decoded. Return the bytes now in the buffer.
+ */
+static size_t stream_fill(stream_t *s)
+{
+    char *buf = s->buf[s->cur ^ 1];
+    size_t left = s->end - s->pos;
+    size_t got = 0;
+    ssize_t n;
+
+    memcpy(buf, s->pos, left);
+    while (!s->eof && (got < STREAM_CHUNK)) {
+	if ((n = read(s->fd, buf + left + got, STREAM_CHUNK - got)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read failed in stream_fill");
+	}
+	if (n == 0)
+	    s->eof = 1;
+	got += n;
+    }
+    s->off += got;
+    if (!s->eof)
+	posix_fadvise(s->fd, s->off, STREAM_CHUNK, POSIX_FADV_WILLNEED);
+
+    s->cur ^= 1;
+    s->pos = buf;
+    s->end = buf + left + got;
+    return left + got;
+}
+
+/*
+ * stream_line - Return the next line of a text trace, NUL-terminated in
+ *   the buffer, or NULL at the end of the trace. Blank lines are skipped.
+ */
+static char *stream_line(stream_t *s)
+{
+    char *line, *nl;
+
+    for (;;) {
+	if ((nl = memchr(s->pos, '\n', s->end - s->pos)) == NULL) {
+	    if (s->end - s->pos > MAXLINE) {
+		sprintf(msg, "Line too long in tracefile %s", s->path);
+		app_error(msg);
+	    }
+	    if (!s->eof) {
+		stream_fill(s);
+		continue;
+	    }
+	    if (s->pos == s->end)
+		return NULL;
+	    nl = s->end; /* the last line has no newline */
+	}
+	line = s->pos;
+	*nl = '\0';
+	s->pos = (nl == s->end) ? nl : nl + 1;
+	line += strspn(line, " \t\r");
+	if (*line != '\0')
+	    return line;
+    }
+}
+
+/*
+ * stream_next - Decode the next request of the streamed trace into op.
+ *   Return 0 at the end of the trace.
+ */
+static int stream_next(stream_t *s, traceop_t *op)
+{
+    char *line, *p;
+
+    if (s->format == PACK_TRACE) {
+	if ((s->end - s->pos < PACK_MAXOP) && (stream_fill(s) == 0))
+	    return 0;
+	s->pos = (char *)unpack_op(&s->pack, (unsigned char *)s->pos, op);
+	if ((s->pos > s->end) || (op->type > USABLE) || (op->index < 0) ||
+	    (op->size < 0)) {
+	    sprintf(msg, "Bad request in packed trace %s", s->path);
+	    app_error(msg);
+	}
+	return 1;
+    }
+
+    if (s->format == BIN_TRACE) {
+	if ((s->end - s->pos < sizeof(traceop_t)) &&
+	    (stream_fill(s) < sizeof(traceop_t))) {
+	    if (s->pos == s->end)
+		return 0;
+	    sprintf(msg, "Truncated request in binary trace %s", s->path);
+	    app_error(msg);
+	}
+	memcpy(op, s->pos, sizeof(traceop_t));
+	s->pos += sizeof(traceop_t);
+	if ((op->type < ALLOC) || (op->type > USABLE) || (op->index < 0) ||
+	    (op->size < 0)) {
+	    sprintf(msg, "Bad request in binary trace %s", s->path);
+	    app_error(msg);
+	}
+	return 1;
+    }
+
+    if ((line = stream_line(s)) == NULL)
+	return 0;
+    memset(op, 0, sizeof(traceop_t));
+    switch (line[0]) {
+    case 'a': op->type = ALLOC; break;
+    case 'r': op->type = REALLOC; break;
+    case 'f': op->type = FREE; break;
+    case 'c': op->type = CALLOC; break;
+    case 'm': op->type = MEMALIGN; break;
+    case 'u': op->type = USABLE; break;
+    default:
+	printf("Bogus type character (%c) in tracefile %s\n",
+	       line[0], s->path);
+	exit(1);
+    }
+    op->index = strtol(line + 1, &p, 10);
+    if (op->type == MEMALIGN)
+	op->align = strtol(p, &p, 10);
+    if ((op->type != FREE) && (op->type != USABLE))
+	op->size = strtol(p, &p, 10);
+    if ((op->index < 0) || (op->size < 0)) {
+	sprintf(msg, "Bad request in tracefile %s", s->path);
+	app_error(msg);
+    }
+    return 1;
+}
+
+/*
+ * stream_close - close the streamed trace and free its buffers
+ */
+static void stream_close(stream_t *s)
+{
+    close(s->fd);
+    free(s->buf[0]);
+    free(s->buf[1]);
+}
+
+/*
+ * slot_home - the slot where the search for id starts
+ */
+static size_t slot_home(slots_t *t, int id)
+{
+    unsigned h = (unsigned)id * 0x9E3779B1u;
+
+    return (h ^ (h >> 15)) & t->mask;
+}
+
+/*
+ * slots_resize - rehash the live-slot table into n slots, a power of 2
+ */
+static void slots_resize(slots_t *t, size_t n)
+{
+    slot_t *old = t->slots;
+    size_t i, old_n = (old != NULL) ? t->mask + 1 : 0;
+
+    if ((t->slots = malloc(n * sizeof(slot_t))) == NULL)
+	unix_error("malloc failed in slots_resize");
+    for (i = 0; i < n; i++)
+	t->slots[i].id = -1;
+    t->mask = n - 1;
+    t->peak = (n > t->peak) ? n : t->peak;
+
+    for (i = 0; i < old_n; i++)
+	if (old[i].id >= 0)
+	    *slot_find(t, old[i].id) = old[i];
+    free(old);
+}
+
+/*
+ * slot_find - the slot of the live block id, or the empty slot that
+ *   ends its search if id is not live
+ */
+static slot_t *slot_find(slots_t *t, int id)
+{
+    size_t i = slot_home(t, id);
+
+    while ((t->slots[i].id != id) && (t->slots[i].id >= 0))
+	i = (i + 1) & t->mask;
+    return &t->slots[i];
+}
+
+/*
+ * slot_add - take a slot for id, which must not be live. The table
+ *   grows first if it would be more than 3/4 full.
+ */
+static slot_t *slot_add(slots_t *t, int id)
+{
+    slot_t *slot;
+
+    if (4 * (t->live + 1) > 3 * (t->mask + 1))
+	slots_resize(t, 2 * (t->mask + 1));
+    slot = slot_find(t, id);
+    slot->id = id;
+    t->live++;
+    return slot;
+}
+
+/*
+ * slot_remove - Empty a slot. The following slots of its run are moved
+ *   back into the hole unless that is before their home, so that every
+ *   search still ends at the right slot. The table shrinks if it is
+ *   less than 1/8 full.
+ */
+static void slot_remove(slots_t *t, slot_t *slot)
+{
+    size_t hole = slot - t->slots;
+    size_t i = hole;
+    size_t home;
+
+    for (;;) {
+	i = (i + 1) & t->mask;
+	if (t->slots[i].id < 0)
+	    break;
+	home = slot_home(t, t->slots[i].id);
+	if (((i - home) & t->mask) >= ((i - hole) & t->mask)) {
+	    t->slots[hole] = t->slots[i];
+	    hole = i;
+	}
+    }
+    t->slots[hole].id = -1;
+    t->live--;
+
+    if ((t->mask + 1 > SLOTS_MIN) && (8 * t->live < t->mask + 1))
+	slots_resize(t, (t->mask + 1) / 2);
+}
+
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
+
+/*
+ * eval_mm_valid - Check the mm malloc package for correctness. Since
+ *   every payload is written here, this run also records the mean
+ *   resident heap (sampled every RSS_SAMPLE ops) and the pages purged
+ *   and faulted in again in stats.
+ */
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 stats_t *stats) 
+{
+    int i, j;
+    int index;
+    int size;
+    int oldsize;
+    size_t usable;
+    double rss = 0;
+    int samples = 0;
+    char *newp;
+    char *oldp;
+    char *p;
+    mm_arena_t *arena = NULL;
+    
+    /* Reset the heap, with no page resident, and free any records in the
+     * range list */
+    mem_reset_heap();
+    clear_ranges(ranges);
+
+    /* Call the mm package's init function */
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+    if (arena_phase && ((arena = mm_arena_create(0)) == NULL)) {
+	malloc_error(tracenum, 0, "mm_arena_create failed.");
+	return 0;
+    }
+
+    /* Interpret each operation in the trace in order */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	/* sample the resident heap */
+	if (i % RSS_SAMPLE == 0) {
+	    rss += (double)mem_resident();
+	    samples++;
+	}
+
+	/* a new arena phase */
+	if (arena && (i > 0) && (i % arena_phase == 0))
+	    mm_arena_reset(arena);
+
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+
+	    /* Call the student's malloc */
+	    if (trace->ops[i].arena & ARENA_NEW)
+		p = mm_arena_alloc(arena, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_malloc failed.");
+		return 0;
+	    }
+	    
+	    /* 
+	     * Test the range of the new block for correctness and add it 
+	     * to the range list if OK. The block must be  be aligned properly,
+	     * and must not overlap any currently allocated block. 
+	     */ 
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    
+	    /* ADDED: cgw
+	     * fill range with the pattern of index.  This will be used later
+	     * if we realloc the block and wish to make sure that the old
+	     * data was copied to the new block
+	     */
+	    fill_block(p, index, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case REALLOC: /* mm_realloc */
+	    
+	    /* Call the student's realloc */
+	    oldp = trace->blocks[index];
+	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    
+	    /* Remove the old region from the range list */
+	    remove_range(ranges, oldp, trace->block_sizes[index]);
+	    
 	    /* Check new block for correctness and add it to range list */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
 	     * Make sure that the new block contains the data from the old 
-	     * block and then fill in the new block with the low order byte
-	     * of the new index
+	     * block at every offset and then fill in the rest of the new 
+	     * block with the pattern
 	     */
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
-			     "data from old block");
+	    if ((j = check_block(newp, index, oldsize)) != oldsize) {
+		sprintf(msg, "mm_realloc did not preserve the data from old "
+			"block at offset %d", j);
+		malloc_error(tracenum, i, msg);
 		return 0;
-	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    fill_block(newp, index, size);
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -670,8 +1986,75 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    remove_range(ranges, p, trace->block_sizes[index]);
+	    if (trace->ops[i].arena & ARENA_OLD)
+		break; /* until the next phase */
+	    if (sized_free)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
+	    break;
+
+        case CALLOC: /* mm_calloc */
+
+	    if ((p = mm_calloc(1, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+
+	    /* the block must be zeroed before we fill it */
+	    if (SAMPLED(index) && (check_pattern(p, size, 0, 0) != size)) {
+		malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		return 0;
+	    }
+	    fill_block(p, index, size);
+
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case MEMALIGN: /* mm_memalign */
+
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+	    if ((size_t)p % trace->ops[i].align) {
+		sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+			p, trace->ops[i].align);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    fill_block(p, index, size);
+
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case USABLE: /* mm_usable_size */
+
+	    /* 
+	     * The usable size must cover the block, and all of it must be
+	     * free to use: the block is checked and filled to its full
+	     * usable size, which a later realloc then has to preserve.
+	     */
+	    p = trace->blocks[index];
+	    if (trace->ops[i].arena & ARENA_OLD)
+		break;
+	    usable = mm_usable_size(p);
+	    if (usable < trace->block_sizes[index]) {
+		malloc_error(tracenum, i, "mm_usable_size is smaller than the block");
+		return 0;
+	    }
+	    remove_range(ranges, p, trace->block_sizes[index]);
+	    if (add_range(ranges, p, usable, tracenum, i) == 0)
+		return 0;
+	    fill_block(p, index, usable);
+	    trace->block_sizes[index] = usable;
 	    break;
 
 	default:
@@ -680,6 +2063,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     }
 
+    if (arena)
+	mm_arena_destroy(arena);
+
+    stats->rss = (samples > 0) ? rss / samples : 0;
+    stats->purged = (double)mem_purged_pages();
+    stats->refaulted = (double)mem_refaulted_pages();
+    stats->maps = (double)mem_map_count();
+    stats->remapped = (double)mem_remapped_bytes();
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
@@ -689,13 +2081,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap in bytes while running the student's malloc 
+ *   package on the trace. Since mem_sbrk() lets the students decrement
+ *   the brk pointer, the peak and the final heap size are recorded
+ *   separately in stats.
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats)
 {   
     int i;
     int index;
@@ -704,20 +2097,30 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    mm_arena_t *arena = NULL;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    if (arena_phase && ((arena = mm_arena_create(0)) == NULL))
+	app_error("mm_arena_create failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	if (arena && (i > 0) && (i % arena_phase == 0))
+	    mm_arena_reset(arena);
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].arena & ARENA_NEW)
+		p = mm_arena_alloc(arena, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -760,7 +2163,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (trace->ops[i].arena & ARENA_OLD)
+		; /* until the next phase */
+	    else if (sized_free)
+		mm_free_sized(p, trace->ops[i].size);
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -768,13 +2176,40 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (trace->ops[i].type == CALLOC)
+		p = mm_calloc(1, size);
+	    else
+		p = mm_memalign(trace->ops[i].align, size);
+	    if (p == NULL)
+		app_error("mm_calloc or mm_memalign failed in eval_mm_util");
+
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case USABLE: /* mm_usable_size, the payload stays the same */
+	    if (!(trace->ops[i].arena & ARENA_OLD))
+		mm_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->peak = (double)mem_peak_heapsize();
+    stats->final = (double)mem_heapsize();
+    return ((double)max_total_size / stats->peak);
 }
 
 
@@ -787,20 +2222,30 @@ static void eval_mm_speed(void *ptr)
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    mm_arena_t *arena = NULL;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    if (arena_phase && ((arena = mm_arena_create(0)) == NULL))
+	app_error("mm_arena_create failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
+	if (arena && (i > 0) && (i % arena_phase == 0))
+	    mm_arena_reset(arena);
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+	    if (trace->ops[i].arena & ARENA_NEW)
+		p = mm_arena_alloc(arena, size);
+	    else
+		p = mm_malloc(size);
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -817,14 +2262,612 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+	    if (trace->ops[i].arena & ARENA_OLD)
+		break; /* until the next phase */
+            if (sized_free)
+		mm_free_sized(block, trace->ops[i].size);
+	    else
+		mm_free(block);
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case USABLE: /* mm_usable_size */
+	    if (!(trace->ops[i].arena & ARENA_OLD))
+		mm_usable_size(trace->blocks[trace->ops[i].index]);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+    }
+}
+
+/*
+ * eval_batch_valid - Check that mm_malloc_batch returns n distinct,
+ *    aligned blocks inside the heap, twice in a row with mm_free_batch
+ *    in between. Errors are reported with the index of the size as the
+ *    trace number and the index of the block as the request number.
+ */
+static int eval_batch_valid(batch_t *params, int sizenum, range_t **ranges)
+{
+    int i, k;
+    char *p;
+
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(sizenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    for (k = 0; k < 2; k++) {
+	if ((int)mm_malloc_batch(params->size, params->ptrs, params->n) != params->n) {
+	    malloc_error(sizenum, 0, "mm_malloc_batch failed.");
+	    return 0;
+	}
+	for (i = 0; i < params->n; i++) {
+	    p = params->ptrs[i];
+	    if (add_range(ranges, p, params->size, sizenum, i) == 0)
+		return 0;
+	    fill_block(p, i, params->size);
+	}
+	for (i = 0; i < params->n; i++) {
+	    p = params->ptrs[i];
+	    if (check_block(p, i, params->size) != params->size) {
+		malloc_error(sizenum, i, "mm_malloc_batch block was overwritten");
+		return 0;
+	    }
+	    remove_range(ranges, p, params->size);
+	}
+	mm_free_batch(params->ptrs, params->n);
+    }
+    return 1;
+}
+
+/*
+ * eval_batch_speed - This is the function that is used by fcyc()
+ *    to measure the running time of BATCH_ROUNDS batches of blocks, 
+ *    allocated and freed either with the batch calls or one by one.
+ */
+static void eval_batch_speed(void *ptr)
+{
+    batch_t *params = ptr;
+    int i, k;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_batch_speed");
+
+    for (k = 0; k < BATCH_ROUNDS; k++) {
+	if (params->batch) {
+	    if ((int)mm_malloc_batch(params->size, params->ptrs, params->n) != params->n)
+		app_error("mm_malloc_batch error in eval_batch_speed");
+	    mm_free_batch(params->ptrs, params->n);
+	}
+	else {
+	    for (i = 0; i < params->n; i++)
+		if ((params->ptrs[i] = mm_malloc(params->size)) == NULL)
+		    app_error("mm_malloc error in eval_batch_speed");
+	    for (i = 0; i < params->n; i++)
+		mm_free(params->ptrs[i]);
+	}
+    }
+}
+
+/*
+ * eval_batch - For every size in batch_sizes, time batches of n blocks
+ *    allocated and freed one by one against the batch calls, and print
+ *    the time per block.
+ */
+static void eval_batch(int n, range_t **ranges)
+{
+    int i;
+    double single, batch, blocks;
+    batch_t params;
+
+    if ((params.ptrs = calloc(n, sizeof(void *))) == NULL)
+	unix_error("ptrs calloc in eval_batch failed");
+    params.n = n;
+    blocks = (double)n * BATCH_ROUNDS;
+
+    printf("\nBatch benchmark, %d blocks per batch:\n", n);
+    printf("%6s%14s%14s%9s\n", "size", "single ns/blk", "batch ns/blk", "speedup");
+    for (i = 0; batch_sizes[i] != 0; i++) {
+	params.size = batch_sizes[i];
+	if (!eval_batch_valid(&params, i, ranges)) {
+	    printf("%6d%14s%14s%9s\n", params.size, "-", "-", "-");
+	    continue;
+	}
+	params.batch = 0;
+	single = fsecs(eval_batch_speed, &params);
+	params.batch = 1;
+	batch = fsecs(eval_batch_speed, &params);
+	printf("%6d%14.1f%14.1f%8.2fx\n", params.size, 
+	       single/blocks*1e9, batch/blocks*1e9, single/batch);
+    }
+    free(params.ptrs);
+}
+
+/*
+ * eval_stream_op - Run request opnum of a streamed trace with the checks
+ *   of eval_mm_valid, the live blocks are kept in the table t. Keep
+ *   track of the total size requested for the live blocks in total_size.
+ */
+static int eval_stream_op(traceop_t *op, int opnum, slots_t *t,
+			  range_t **ranges, double *total_size)
+{
+    slot_t *slot;
+    size_t usable;
+    int oldsize, j;
+    char *p;
+
+    slot = slot_find(t, op->index);
+    if ((slot->id < 0) !=
+	((op->type == ALLOC) || (op->type == CALLOC) || (op->type == MEMALIGN))) {
+	sprintf(msg, "Request on id %d, which is %s allocated", op->index,
+		(slot->id < 0) ? "not" : "already");
+	malloc_error(0, opnum, msg);
+	return 0;
+    }
+
+    switch (op->type) {
+
+    case ALLOC: /* mm_malloc */
+    case CALLOC: /* mm_calloc */
+    case MEMALIGN: /* mm_memalign */
+
+	if (op->type == ALLOC)
+	    p = mm_malloc(op->size);
+	else if (op->type == CALLOC)
+	    p = mm_calloc(1, op->size);
+	else
+	    p = mm_memalign(op->align, op->size);
+	if (p == NULL) {
+	    malloc_error(0, opnum, "mm_malloc, mm_calloc or mm_memalign failed.");
+	    return 0;
+	}
+	if ((op->type == MEMALIGN) && ((size_t)p % op->align)) {
+	    sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+		    p, op->align);
+	    malloc_error(0, opnum, msg);
+	    return 0;
+	}
+	if (add_range(ranges, p, op->size, 0, opnum) == 0)
+	    return 0;
+	if ((op->type == CALLOC) && SAMPLED(op->index) &&
+	    (check_pattern(p, op->size, 0, 0) != op->size)) {
+	    malloc_error(0, opnum, "mm_calloc did not zero the block");
+	    return 0;
+	}
+	fill_block(p, op->index, op->size);
+
+	slot = slot_add(t, op->index);
+	slot->p = p;
+	slot->size = slot->req = op->size;
+	*total_size += op->size;
+	break;
+
+    case REALLOC: /* mm_realloc */
+
+	if ((p = mm_realloc(slot->p, op->size)) == NULL) {
+	    malloc_error(0, opnum, "mm_realloc failed.");
+	    return 0;
+	}
+	remove_range(ranges, slot->p, slot->size);
+	if (add_range(ranges, p, op->size, 0, opnum) == 0)
+	    return 0;
+	oldsize = (op->size < slot->size) ? op->size : slot->size;
+	if ((j = check_block(p, op->index, oldsize)) != oldsize) {
+	    sprintf(msg, "mm_realloc did not preserve the data from old "
+		    "block at offset %d", j);
+	    malloc_error(0, opnum, msg);
+	    return 0;
+	}
+	fill_block(p, op->index, op->size);
+
+	*total_size += op->size - slot->req;
+	slot->p = p;
+	slot->size = slot->req = op->size;
+	break;
+
+    case FREE: /* mm_free */
+
+	remove_range(ranges, slot->p, slot->size);
+	if (sized_free)
+	    mm_free_sized(slot->p, slot->size);
+	else
+	    mm_free(slot->p);
+	*total_size -= slot->req;
+	slot_remove(t, slot);
+	break;
+
+    case USABLE: /* mm_usable_size */
+
+	/* as in eval_mm_valid, the block grows to its usable size */
+	usable = mm_usable_size(slot->p);
+	if (usable < slot->size) {
+	    malloc_error(0, opnum, "mm_usable_size is smaller than the block");
+	    return 0;
+	}
+	remove_range(ranges, slot->p, slot->size);
+	if (add_range(ranges, slot->p, usable, 0, opnum) == 0)
+	    return 0;
+	fill_block(slot->p, op->index, usable);
+	slot->size = usable;
+	break;
+
+    default:
+	app_error("Nonexistent request type in eval_stream_op");
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_stream - This is the function that is timed by ftimer to
+ *    replay a streamed trace once, from the file, with every check of
+ *    eval_mm_valid. The trace is not held in memory, only a live-slot
+ *    table of its live blocks, so the time includes reading the trace
+ *    and checking the blocks. The space utilization is recorded as in
+ *    eval_mm_util.
+ */
+static void eval_mm_stream(void *ptr)
+{
+    stream_params_t *params = ptr;
+    stream_t s;
+    slots_t t = {NULL, 0, 0, 0};
+    traceop_t op;
+    double total_size = 0, max_total_size = 0;
+    int i;
+
+    mem_reset_heap();
+    clear_ranges(params->ranges);
+    if (mm_init() < 0) {
+	malloc_error(0, 0, "mm_init failed.");
+	params->valid = 0;
+	return;
+    }
+    stream_open(&s, params->path);
+    slots_resize(&t, SLOTS_MIN);
+
+    params->valid = 1;
+    params->peak_live = 0;
+    for (i = 0; params->valid && stream_next(&s, &op); i++) {
+	params->valid = eval_stream_op(&op, i, &t, params->ranges, &total_size);
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+	if (t.live > params->peak_live)
+	    params->peak_live = t.live;
+    }
+    if (params->valid && (i != s.num_ops)) {
+	sprintf(msg, "Tracefile %s has %d requests, its header %d",
+		params->path, i, s.num_ops);
+	app_error(msg);
+    }
+
+    params->stats->ops = i;
+    params->stats->peak = (double)mem_peak_heapsize();
+    params->stats->final = (double)mem_heapsize();
+    params->stats->util = max_total_size / params->stats->peak;
+    params->peak_slots = t.peak;
+    free(t.slots);
+    stream_close(&s);
+}
+
+/*
+ * eval_stream - Replay the trace at path as it is read, and print its
+ *    space utilization, the replay time and the memory the driver held.
+ */
+static void eval_stream(char *path, range_t **ranges)
+{
+    stats_t stats;
+    stream_params_t params;
+    double secs;
+
+    memset(&stats, 0, sizeof(stats));
+    params.path = path;
+    params.ranges = ranges;
+    params.stats = &stats;
+
+    printf("\nStreaming %s:\n", path);
+    secs = ftimer_gettod(eval_mm_stream, &params, 1);
+    if (!params.valid) {
+	printf("invalid\n");
+	return;
+    }
+    printf("%.0f ops in %.3f secs (%.0f Kops), with the checks\n",
+	   stats.ops, secs, stats.ops / 1e3 / secs);
+    printf("util %.0f%%, peak heap %.0f KB\n",
+	   stats.util * 100.0, stats.peak / 1024);
+    printf("driver: %lu KB of buffers, %lu KB of slots at most for %lu live blocks at most\n",
+	   (unsigned long)(2 * (STREAM_CHUNK + MAXLINE + 1)) / 1024,
+	   (unsigned long)(params.peak_slots * sizeof(slot_t)) / 1024,
+	   (unsigned long)params.peak_live);
+}
+
+#ifdef THREAD_SAFE
+/*
+ * stress_rand - The next number of the xorshift generator of thread t
+ */
+static unsigned stress_rand(stress_t *t)
+{
+    t->rand ^= t->rand << 13;
+    t->rand ^= t->rand >> 17;
+    t->rand ^= t->rand << 5;
+    return t->rand;
+}
+
+/*
+ * stress_size - A random request size: mostly small enough for the 
+ *    thread caches, some larger, and a few huge enough to be mapped
+ */
+static int stress_size(stress_t *t)
+{
+    unsigned r = stress_rand(t);
+
+    if (r % 256 == 0)
+	return 1 + (stress_rand(t) % STRESS_HUGE);
+    if (r % 16 == 0)
+	return 1 + (stress_rand(t) % 8192);
+    return 1 + (stress_rand(t) % 256);
+}
+
+/*
+ * stress_check - Check that block b still holds its pattern, and count 
+ *    an error of thread t if it does not
+ */
+static int stress_check(stress_t *t, sblock_t *b, char *what)
+{
+    size_t j;
+
+    if ((j = check_pattern(b->p, b->size, b->seed, PATTERN_STEP)) == (size_t)b->size)
+	return 1;
+    printf("ERROR [thread %d]: payload of %d bytes at %p changed at offset %lu before %s\n",
+	   t->id, b->size, b->p, (unsigned long)j, what);
+    t->errors++;
+    return 0;
+}
+
+/*
+ * stress_new - Allocate a block of a random size with a random call 
+ *    into b and fill it with a pattern of its own
+ */
+static int stress_new(stress_t *t, sblock_t *b)
+{
+    unsigned r = stress_rand(t);
+
+    b->size = stress_size(t);
+    b->seed = PATTERN_SEED(((pword_t)t->id << 32) | t->blocks++);
+    if (r % 16 == 0)
+	b->p = mm_calloc(1, b->size);
+    else if (r % 16 == 1)
+	b->p = mm_memalign(STRESS_ALIGN, b->size);
+    else
+	b->p = mm_malloc(b->size);
+
+    if (b->p == NULL) {
+	printf("ERROR [thread %d]: allocation of %d bytes failed\n", 
+	       t->id, b->size);
+	t->errors++;
+	return 0;
+    }
+    if (!IS_ALIGNED(b->p) || 
+	((r % 16 == 1) && ((size_t)b->p % STRESS_ALIGN))) {
+	printf("ERROR [thread %d]: payload address (%p) not aligned\n", 
+	       t->id, b->p);
+	t->errors++;
+    }
+    if ((r % 16 == 0) && (check_pattern(b->p, b->size, 0, 0) != (size_t)b->size)) {
+	printf("ERROR [thread %d]: mm_calloc did not zero the block\n", t->id);
+	t->errors++;
+    }
+    fill_pattern(b->p, b->size, b->seed, PATTERN_STEP);
+    return 1;
+}
+
+/*
+ * stress_free - Check block b and free it, with mm_free_sized one time 
+ *    in two
+ */
+static void stress_free(stress_t *t, sblock_t *b)
+{
+    stress_check(t, b, "its free");
+    if (stress_rand(t) & 1)
+	mm_free_sized(b->p, b->size);
+    else
+	mm_free(b->p);
+    b->p = NULL;
+}
+
+/*
+ * stress_pass - Hand block b over to the next thread, which frees it. 
+ *    If its queue is full, b is freed here.
+ */
+static void stress_pass(stress_t *t, sblock_t *b)
+{
+    stress_t *next = t->next;
+
+    pthread_mutex_lock(&next->lock);
+    if (next->passed < STRESS_QUEUE) {
+	next->queue[next->passed++] = *b;
+	b->p = NULL;
+    }
+    pthread_mutex_unlock(&next->lock);
+    if (b->p != NULL)
+	stress_free(t, b);
+}
+
+/*
+ * stress_drain - Free the blocks other threads handed over to thread t
+ */
+static void stress_drain(stress_t *t)
+{
+    sblock_t queue[STRESS_QUEUE];
+    int i, n;
+
+    pthread_mutex_lock(&t->lock);
+    n = t->passed;
+    memcpy(queue, t->queue, n * sizeof(sblock_t));
+    t->passed = 0;
+    pthread_mutex_unlock(&t->lock);
+
+    for (i = 0; i < n; i++)
+	stress_free(t, &queue[i]);
+}
+
+/*
+ * stress_batch - Allocate a batch of blocks of one size, fill them, 
+ *    then check them and free them as a batch
+ */
+static void stress_batch(stress_t *t)
+{
+    void *ptrs[STRESS_BATCH];
+    sblock_t b;
+    size_t i, n;
+
+    b.size = 1 + (stress_rand(t) % 256);
+    n = mm_malloc_batch(b.size, ptrs, STRESS_BATCH);
+    for (i = 0; i < n; i++)
+	fill_pattern(ptrs[i], b.size, PATTERN_SEED(i), PATTERN_STEP);
+    for (i = 0; i < n; i++) {
+	b.p = ptrs[i];
+	b.seed = PATTERN_SEED(i);
+	stress_check(t, &b, "the batch free");
+    }
+    mm_free_batch(ptrs, n);
 }
 
+/*
+ * stress_thread - The requests of one thread of the stress test: 
+ *    random allocations, reallocations and frees of STRESS_SLOTS live 
+ *    blocks, a part of which are freed by the next thread
+ */
+static void *stress_thread(void *arg)
+{
+    stress_t *t = arg;
+    sblock_t slots[STRESS_SLOTS];
+    sblock_t *b;
+    char *p;
+    int i, size, oldsize;
+    unsigned r;
+
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < STRESS_OPS; i++) {
+	r = stress_rand(t);
+	b = &slots[r % STRESS_SLOTS];
+	r >>= 16;
+
+	if (b->p == NULL)
+	    stress_new(t, b);
+	else if (r % 8 == 0) {
+	    size = stress_size(t);
+	    stress_check(t, b, "its realloc");
+	    if ((p = mm_realloc(b->p, size)) == NULL) {
+		printf("ERROR [thread %d]: mm_realloc to %d bytes failed\n",
+		       t->id, size);
+		t->errors++;
+		continue;
+	    }
+	    oldsize = (size < b->size) ? size : b->size;
+	    if (check_pattern(p, oldsize, b->seed, PATTERN_STEP) != (size_t)oldsize) {
+		printf("ERROR [thread %d]: mm_realloc did not preserve the data\n",
+		       t->id);
+		t->errors++;
+	    }
+	    b->p = p;
+	    b->size = size;
+	    fill_pattern(b->p, b->size, b->seed, PATTERN_STEP);
+	}
+	else if (r % 8 == 1)
+	    stress_pass(t, b);
+	else
+	    stress_free(t, b);
+
+	if (i % STRESS_DRAIN == 0)
+	    stress_drain(t);
+	if (i % STRESS_BATCH_EVERY == 0)
+	    stress_batch(t);
+    }
+
+    for (i = 0; i < STRESS_SLOTS; i++)
+	if (slots[i].p != NULL)
+	    stress_free(t, &slots[i]);
+    stress_drain(t);
+    return NULL;
+}
+
+/*
+ * eval_threads_run - Start the threads of the stress test and wait for 
+ *    all of them, this is timed by ftimer
+ */
+static void eval_threads_run(void *ptr)
+{
+    stress_params_t *params = ptr;
+    int i;
+
+    for (i = 0; i < params->n; i++)
+	if (pthread_create(&params->threads[i].tid, NULL, stress_thread, 
+			   &params->threads[i]) != 0)
+	    unix_error("pthread_create failed in eval_threads_run");
+    for (i = 0; i < params->n; i++)
+	pthread_join(params->threads[i].tid, NULL);
+}
+
+/*
+ * eval_threads - Run the stress test with n threads at once on a new 
+ *    heap, and report the errors found by the pattern checks
+ */
+static void eval_threads(int n)
+{
+    stress_t *threads;
+    stress_params_t params;
+    int i;
+    double secs;
+
+    if ((threads = calloc(n, sizeof(stress_t))) == NULL)
+	unix_error("threads calloc in eval_threads failed");
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_threads");
+
+    for (i = 0; i < n; i++) {
+	threads[i].id = i;
+	threads[i].rand = 2463534242U + 7919 * i;
+	threads[i].next = &threads[(i + 1) % n];
+	pthread_mutex_init(&threads[i].lock, NULL);
+    }
+
+    printf("\nStress test, %d threads of %d requests:\n", n, STRESS_OPS);
+    params.threads = threads;
+    params.n = n;
+    secs = ftimer_gettod(eval_threads_run, &params, 1);
+
+    /* a thread may pass blocks on after the next one is done */
+    for (i = 0; i < n; i++)
+	stress_drain(&threads[i]);
+    for (i = 0; i < n; i++) {
+	errors += threads[i].errors;
+	pthread_mutex_destroy(&threads[i].lock);
+    }
+
+    printf("%s in %.3f secs\n", errors ? "invalid" : "valid", secs);
+    free(threads);
+}
+#endif
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -861,6 +2904,27 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case MEMALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align, 
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case USABLE: /* malloc_usable_size */
+	    malloc_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -906,6 +2970,25 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case MEMALIGN: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case USABLE: /* malloc_usable_size */
+	    malloc_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
 	}
     }
 }
@@ -924,49 +3007,89 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
-
-    /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    double peak = 0;
+    double final = 0;
+    double rss = 0;
+    double purged = 0;
+    double refaulted = 0;
+    double maps = 0;
+    double remapped = 0;
+
+    /* Print the individual results for each trace, the sizes in kB */
+    printf("%5s%7s %5s%8s%10s%6s%8s%8s%8s%8s%8s%6s%8s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "peak", "final",
+	   "rss", "purge", "refault", "maps", "remap");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (stats[i].peak > 0)  /* not measured for libc */
+		printf("%8.0f%8.0f%8.0f%8.0f%8.0f%6.0f%8.0f\n", stats[i].peak/1e3,
+		       stats[i].final/1e3, stats[i].rss/1e3, stats[i].purged,
+		       stats[i].refaulted, stats[i].maps, stats[i].remapped/1e3);
+	    else
+		printf("%8s%8s%8s%8s%8s%6s%8s\n", "-", "-", "-", "-", "-", "-", "-");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    peak += stats[i].peak;
+	    final += stats[i].final;
+	    rss += stats[i].rss;
+	    purged += stats[i].purged;
+	    refaulted += stats[i].refaulted;
+	    maps += stats[i].maps;
+	    remapped += stats[i].remapped;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%8s%10s%6s%8s%8s%8s%8s%8s%6s%8s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-",
 		   "-");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (peak > 0)
+	    printf("%8.0f%8.0f%8.0f%8.0f%8.0f%6.0f%8.0f\n", peak/1e3, final/1e3,
+		   rss/1e3, purged, refaulted, maps, remapped/1e3);
+	else
+	    printf("%8s%8s%8s%8s%8s%6s%8s\n", "-", "-", "-", "-", "-", "-", "-");
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%8s%10s%6s%8s%8s%8s%8s%8s%6s%8s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
+	       "-",
+	       "-",
+	       "-",
+	       "-",
+	       "-",
+	       "-",
+	       "-",
 	       "-");
     }
 
@@ -1004,14 +3127,24 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVals] [-f <file>] [-t <dir>] [-b <n>] [-H <mb>] [-A <n>] [-S <n>] [-C <file>] [-F <file>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <n>     Replay the traces with a phase arena, reset every n ops.\n");
+    fprintf(stderr, "\t-b <n>     Run the batch benchmark, n blocks per batch.\n");
+    fprintf(stderr, "\t-C <file>  Convert the -f trace to <file>, a text trace if it ends in\n");
+    fprintf(stderr, "\t           .rep, a packed trace if it ends in .rz, else a binary trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <file>  Stream the trace file <file> with bounded memory.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <mb>    Allow a heap of up to mb MB (default %d).\n",
+	    MAX_HEAP >> 20);
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-s         Free blocks with mm_free_sized.\n");
+    fprintf(stderr, "\t-S <n>     Fill and check only one payload in n.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Run the stress test with n threads (make threaded).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
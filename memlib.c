@@ -2,7 +2,19 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The heap is an mmap reservation of inaccessible address space, which is
+ * committed (made readable and writable) MEM_COMMIT bytes at a time as the
+ * brk grows, so only the memory the heap has used is backed by pages.
+ * Pages given back by a shrink or by mem_purge are dropped with
+ * MADV_DONTNEED, and a bitmap of purged pages tells when one is faulted
+ * in again.
+ *
+ * Blocks too large for the heap can be mapped on their own with mem_map.
+ * Their bytes count towards the heap size, so the footprint of a trace
+ * includes them, and mem_reset_brk unmaps the ones left over.
  */
+#define _GNU_SOURCE  /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +26,81 @@
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_COMMIT (1<<16)  /* the heap is committed in steps of 64kB */
+
+/* round an address in the heap down or up to a page boundary */
+#define PAGE_DOWN(p) (mem_start_brk + (size_t)((p) - mem_start_brk) / mem_page * mem_page)
+#define PAGE_UP(p)   PAGE_DOWN((p) + mem_page - 1)
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_dirty_brk;  /* bytes below it may be non-zero */
+static char *mem_commit_brk; /* bytes below it are readable and writable */
+static size_t mem_page;      /* page size */
+static size_t mem_peak;      /* largest heap size since the last reset */
+
+/* the blocks mapped with mem_map, most recent first */
+typedef struct mem_mapping {
+    char *addr;
+    size_t size;
+    struct mem_mapping *next;
+} mem_mapping_t;
+
+static mem_mapping_t *mem_mappings;
+static size_t mem_mapped;             /* bytes mapped */
+static size_t mem_maps;               /* mem_map calls that succeeded */
+static size_t mem_remapped;           /* bytes moved by mem_remap without a copy */
+
+static unsigned char *mem_purge_map;  /* one bit per page, set when purged */
+static unsigned char *mem_core;       /* mincore vector of the heap */
+static size_t mem_purged;             /* resident pages purged */
+static size_t mem_refaulted;          /* purged pages faulted in again */
+
+static int mem_commit(char *addr);
+static void mem_drop(void);
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model with MAX_HEAP bytes
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_init_size(MAX_HEAP);
+}
+
+/*
+ * mem_init_size - initialize the memory system model with a heap of at
+ *    most max_heap bytes, only address space is reserved up front
+ */
+void mem_init_size(size_t max_heap)
+{
+    void *p;
+    size_t npages;
+
+    /* reserve the address space we will use to model the available VM */
+    mem_page = mem_pagesize();
+    max_heap = (max_heap + mem_page - 1) & ~(mem_page - 1);
+    p = mmap(NULL, max_heap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error reserving %zu bytes\n", max_heap);
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_start_brk = (char *)p;
+    mem_max_addr = mem_start_brk + max_heap;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_dirty_brk = mem_start_brk;            /* and zero-filled */
+    mem_peak = 0;
+    mem_commit_brk = mem_start_brk;           /* and not committed */
+
+    npages = max_heap / mem_page;
+    if ((mem_purge_map = calloc((npages + 7) / 8, 1)) == NULL ||
+	(mem_core = malloc(npages)) == NULL) {
+	fprintf(stderr, "mem_init_vm: malloc error\n");
+	exit(1);
+    }
+    mem_purged = mem_refaulted = 0;
 }
 
 /* 
@@ -39,35 +108,323 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, (size_t)(mem_max_addr - mem_start_brk));
+    free(mem_purge_map);
+    free(mem_core);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    the pages of the old heap stay resident, its mappings are unmapped
  */
 void mem_reset_brk()
 {
+    mem_mapping_t *m;
+
+    while ((m = mem_mappings) != NULL) {
+	mem_mappings = m->next;
+	munmap(m->addr, m->size);
+	free(m);
+    }
+    mem_mapped = mem_maps = mem_remapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
+    memset(mem_purge_map, 0, ((mem_commit_brk - mem_start_brk) / mem_page + 7) / 8);
+    mem_purged = mem_refaulted = 0;
+}
+
+/*
+ * mem_reset_heap - reset the brk like mem_reset_brk, and drop every page
+ *    of the old heap, so that the resident heap can be measured from zero
+ */
+void mem_reset_heap()
+{
+    mem_reset_brk();
+    mem_drop();
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area, or
+ *    shrinks it when incr is negative and returns the old brk, the
+ *    whole pages above the new brk are dropped. Like fresh pages from
+ *    the kernel, the new area is zero-filled, so memory handed out
+ *    before mem_reset_brk is cleared again when the heap grows over it.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < 0) {
+	if (-(size_t)incr > (size_t)(mem_brk - mem_start_brk)) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+	    return (void *)-1;
+	}
+	mem_brk += incr;
+	mem_drop();
+	return (void *)old_brk;
+    }
+    if (incr > mem_max_addr - mem_brk) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
+    if (mem_brk + incr > mem_commit_brk && mem_commit(mem_brk + incr) < 0) {
+	fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit memory...\n");
+	return (void *)-1;
+    }
     mem_brk += incr;
+    if (mem_heapsize() > mem_peak)
+	mem_peak = mem_heapsize();
+    if (old_brk < mem_dirty_brk)
+	memset(old_brk, 0, ((mem_brk < mem_dirty_brk) ? mem_brk : mem_dirty_brk) - old_brk);
+    if (mem_brk > mem_dirty_brk)
+	mem_dirty_brk = mem_brk;
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - map size bytes of zero-filled memory outside the heap,
+ *    returns NULL if that fails
+ */
+void *mem_map(size_t size)
+{
+    mem_mapping_t *m;
+    void *p;
+
+    if ((m = malloc(sizeof(mem_mapping_t))) == NULL)
+	return NULL;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+	free(m);
+	return NULL;
+    }
+    m->addr = (char *)p;
+    m->size = size;
+    m->next = mem_mappings;
+    mem_mappings = m;
+    mem_mapped += size;
+    mem_maps++;
+    if (mem_heapsize() > mem_peak)
+	mem_peak = mem_heapsize();
+    return p;
+}
+
+/*
+ * mem_find - return the link to the mapping at p
+ */
+static mem_mapping_t **mem_find(void *p)
+{
+    mem_mapping_t **mp;
+
+    for (mp = &mem_mappings; *mp != NULL; mp = &(*mp)->next)
+	if ((*mp)->addr == (char *)p)
+	    return mp;
+    fprintf(stderr, "ERROR: no mapping at %p\n", p);
+    exit(1);
+}
+
+/*
+ * mem_unmap - unmap the mapping of size bytes at p made by mem_map
+ */
+void mem_unmap(void *p, size_t size)
+{
+    mem_mapping_t **mp = mem_find(p), *m = *mp;
+
+    assert(m->size == size);
+    *mp = m->next;
+    free(m);
+    munmap(p, size);
+    mem_mapped -= size;
+}
+
+/*
+ * mem_remap - resize the mapping of old_size bytes at p to new_size bytes,
+ *    moving it if need be. The kernel moves the pages themselves, so no
+ *    byte is copied. Returns the new address, or NULL and leaves the
+ *    mapping alone if that fails.
+ */
+void *mem_remap(void *p, size_t old_size, size_t new_size)
+{
+    mem_mapping_t *m = *mem_find(p);
+    void *q;
+
+    assert(m->size == old_size);
+    if ((q = mremap(p, old_size, new_size, MREMAP_MAYMOVE)) == MAP_FAILED)
+	return NULL;
+    m->addr = (char *)q;
+    m->size = new_size;
+    mem_mapped = mem_mapped - old_size + new_size;
+    mem_remapped += (old_size < new_size) ? old_size : new_size;
+    if (mem_heapsize() > mem_peak)
+	mem_peak = mem_heapsize();
+    return q;
+}
+
+/*
+ * mem_is_mapped - return true if [lo, hi] lies in one mapping
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_mapping_t *m;
+
+    for (m = mem_mappings; m != NULL; m = m->next)
+	if ((char *)lo >= m->addr && (char *)hi < m->addr + m->size)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_map_count - mappings made since the heap was last reset
+ */
+size_t mem_map_count()
+{
+    return mem_maps;
+}
+
+/*
+ * mem_remapped_bytes - bytes carried over by mem_remap since the heap was
+ *    last reset, which a copying realloc would have had to copy
+ */
+size_t mem_remapped_bytes()
+{
+    return mem_remapped;
+}
+
+/*
+ * mem_commit - commit the heap up to at least addr, in MEM_COMMIT steps
+ */
+static int mem_commit(char *addr)
+{
+    size_t size = (size_t)(addr - mem_commit_brk);
+
+    size = (size + MEM_COMMIT - 1) & ~(size_t)(MEM_COMMIT - 1);
+    if (size > (size_t)(mem_max_addr - mem_commit_brk))
+	size = (size_t)(mem_max_addr - mem_commit_brk);
+    if (mprotect(mem_commit_brk, size, PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    mem_commit_brk += size;
+    return 0;
+}
+
+/*
+ * mem_refault - count the purged pages in [lo, hi) that are resident
+ *    again and clear their bits, lo and hi are page aligned
+ */
+static void mem_refault(char *lo, char *hi)
+{
+    size_t i, n = (size_t)(hi - lo) / mem_page;
+    size_t first = (size_t)(lo - mem_start_brk) / mem_page;
+
+    if (n == 0 || mincore(lo, hi - lo, mem_core) < 0)
+	return;
+    for (i = 0; i < n; i++) {
+	if ((mem_purge_map[(first + i) / 8] >> ((first + i) % 8)) & 1) {
+	    if (mem_core[i] & 1) {
+		mem_refaulted++;
+		mem_purge_map[(first + i) / 8] &= ~(1 << ((first + i) % 8));
+	    }
+	}
+    }
+}
+
+/*
+ * mem_drop - drop the whole pages above the brk that may be dirty, they
+ *    read as zero when the heap grows over them again
+ */
+static void mem_drop(void)
+{
+    char *lo = PAGE_UP(mem_brk);
+    char *hi = PAGE_UP(mem_dirty_brk);
+    size_t first, i;
+
+    if (lo >= hi)
+	return;
+    mem_refault(lo, hi);
+    madvise(lo, hi - lo, MADV_DONTNEED);
+    first = (size_t)(lo - mem_start_brk) / mem_page;
+    for (i = 0; i < (size_t)(hi - lo) / mem_page; i++)
+	mem_purge_map[(first + i) / 8] &= ~(1 << ((first + i) % 8));
+    mem_dirty_brk = lo;
+}
+
+/*
+ * mem_purge - give the physical pages wholly inside [lo, hi) back to the
+ *    system with MADV_DONTNEED, they stay part of the heap and read as
+ *    zero when touched again. Returns the number of resident pages purged.
+ */
+size_t mem_purge(void *lo, void *hi)
+{
+    char *p, *q;
+    size_t first, i, n, purged = 0;
+
+    p = PAGE_UP((char *)lo);
+    q = PAGE_DOWN((char *)hi);
+    if (p >= q)
+	return 0;
+
+    mem_refault(p, q);
+    n = (size_t)(q - p) / mem_page;
+    first = (size_t)(p - mem_start_brk) / mem_page;
+    for (i = 0; i < n; i++) {
+	if (mem_core[i] & 1) {
+	    purged++;
+	    mem_purge_map[(first + i) / 8] |= 1 << ((first + i) % 8);
+	}
+    }
+    if (purged > 0)
+	madvise(p, q - p, MADV_DONTNEED);
+    mem_purged += purged;
+    return purged;
+}
+
+/*
+ * mem_resident - return the number of heap bytes backed by resident pages,
+ *    purged pages found resident again are counted as refaulted. The
+ *    pages of the mappings are counted too, a heap-sized piece at a time
+ *    since mem_core only has room for the heap.
+ */
+size_t mem_resident()
+{
+    char *hi = PAGE_UP(mem_brk);
+    size_t i, n = (size_t)(hi - mem_start_brk) / mem_page, resident = 0;
+    size_t max = (size_t)(mem_max_addr - mem_start_brk), off, len;
+    mem_mapping_t *m;
+
+    mem_refault(mem_start_brk, hi);
+    for (i = 0; i < n; i++)
+	resident += mem_core[i] & 1;
+    for (m = mem_mappings; m != NULL; m = m->next) {
+	for (off = 0; off < m->size; off += len) {
+	    len = (m->size - off < max) ? m->size - off : max;
+	    if (mincore(m->addr + off, len, mem_core) < 0)
+		break;
+	    for (i = 0; i < len / mem_page; i++)
+		resident += mem_core[i] & 1;
+	}
+    }
+    return resident * mem_page;
+}
+
+/*
+ * mem_purged_pages - resident pages purged since the heap was last reset
+ */
+size_t mem_purged_pages()
+{
+    return mem_purged;
+}
+
+/*
+ * mem_refaulted_pages - purged pages faulted in again since the heap was
+ *    last reset, as far as mem_purge and mem_resident have seen
+ */
+size_t mem_refaulted_pages()
+{
+    return mem_refaulted;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -85,11 +442,20 @@ void *mem_heap_hi()
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, mappings included
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(mem_brk - mem_start_brk) + mem_mapped;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes since
+ *    the heap was last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_peak;
 }
 
 /*
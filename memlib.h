@@ -1,11 +1,24 @@
 #include <unistd.h>
 
 void mem_init(void);               
+void mem_init_size(size_t max_heap);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void mem_reset_heap(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_purge(void *lo, void *hi);
+size_t mem_resident(void);
+size_t mem_purged_pages(void);
+size_t mem_refaulted_pages(void);
+void *mem_map(size_t size);
+void mem_unmap(void *p, size_t size);
+void *mem_remap(void *p, size_t old_size, size_t new_size);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_map_count(void);
+size_t mem_remapped_bytes(void);
 
@@ -2,19 +2,113 @@
  * free list with immediate boundary-tag coalescing.
  * 
  * Note: this allocator uses a model of the memory system
- * provided by the memlib.c package (max heap size: 20MB).
+ * provided by the memlib.c package (max heap size: 20MB by default, see
+ * mem_init_size). Heap offsets and block sizes are 32-bit words, so the
+ * heap may reach 4GB, and one request at most MAX_REQUEST bytes.
  * 
  * Allocator: segregated free list.
- * Note: This allocator is compiled with option -m32, which sets 
- * long and pointer types to 32 bits.
+ * Note: This allocator is compiled with option -m32 by default, which sets
+ * long and pointer types to 32 bits. It also builds as native 64-bit code
+ * (make M32=), since the free list links are 32-bit heap offsets.
  * 
- * heap block: boundary tags on both free and allocated blocks.
+ * free list: blocks < 4096 bytes are kept in power-of-two size class lists,
+ *            blocks >= 4096 bytes are kept in a treap (Cartesian tree)
+ *            ordered by (size, address), so that inserting, removing and
+ *            searching a large block costs O(log n) expected time.
+ *
+ * heap block: boundary tag on both header and footer for free blocks.
+ *             boundary tag only on header for allocated blocks, the
+ *             allocated bit of the previous block is kept in bit 1 of
+ *             every header instead.
+ *
+ * free node: a free block holds its next/prev (or left/right) links and a
+ *            copy of its header behind them, so a list walk or tree search
+ *            reads the size from the cache line of the links instead of
+ *            the header in front of the node.
+ *
+ * slab: requests <= SLAB_MAX bytes are served from 4kB slab pages, each
+ *       an allocated heap block whose payload is 4kB aligned and carved
+ *       into fixed-size slots without any per-slot header. A bitmap in the
+ *       page header tracks the free slots, and bit 2 of the block header
+ *       marks the block as a slab page. The page of a slot is found by
+ *       rounding the slot address down to 4kB.
+ *
+ * quick lists: a freed block smaller than QUICK_MAX is held in the quick
+ *              list of its size (per 128 bytes) without being coalesced, still
+ *              marked allocated, and is reused by the next request of that
+ *              size. The held blocks are freed and coalesced in one sweep when
+ *              a fit fails or more than QUICK_LIMIT bytes are held.
+ *
+ * purge: a free block in the tree records the heap clock (one tick per
+ *        malloc, free or realloc) when it was freed. A block that holds a
+ *        whole page is also queued in the order it was freed. Every
+ *        PURGE_SWEEP ticks the head of the queue is popped while it was
+ *        freed PURGE_DECAY ticks ago, and the pages wholly inside the
+ *        popped blocks are given back with mem_purge. They are faulted in
+ *        again, as zeros, when the block is reused.
+ *
+ * trim: the same sweep gives all but TRIM_PAD bytes of a free block at the
+ *       end of the heap back to memlib with a negative mem_sbrk, once the
+ *       block holds TRIM_THRESHOLD bytes more and was freed PURGE_DECAY
+ *       ticks ago. A free that leaves twice TRIM_THRESHOLD bytes there
+ *       trims it to TRIM_THRESHOLD at once, so a heap that swings by less
+ *       is not shrunk and refaulted on every swing, but the footprint of
+ *       a heap that has shrunk a lot drops without waiting for a sweep.
+ *       A freed block next to the end of the heap is not held in a
+ *       quick list (unless by mm_free_sized, which reads no neighbor), and
+ *       a free block of TRIM_FLUSH bytes flushes the quick lists and the
+ *       empty slab pages, so that blocks held for reuse do not pin the end.
+ *
+ * lifetime: blocks of different sizes tend to die at different times, and a
+ *           short-lived size wedged between long-lived ones leaves holes
+ *           that no other size fits. A request larger than the running
+ *           mean of the recent request sizes is placed at the high end of
+ *           its free block, a smaller one at the low end, so that the two
+ *           grow towards each other in every chunk and a size that dies
+ *           leaves one contiguous free block.
+ *
+ * huge: a request of at least HUGE_MIN bytes is mapped on its own with
+ *       mem_map, outside the heap. The payload starts a page into the
+ *       mapping, so is_slab never looks in front of the mapping, and that
+ *       page holds the header (with bit 2 set, as no user block outside a
+ *       slab has it) and the offset of the payload. A huge block is
+ *       unmapped when freed and resized with mem_remap, which moves pages
+ *       instead of copying bytes; a block that grows out of the heap is
+ *       mapped once and is never copied again.
+ *
+ * realloc: a block of at least GROW_MIN bytes that grows twice in a row is
+ *          given headroom of half its size, so a growing buffer is copied
+ *          a logarithmic number of times. The headroom is taken back before
+ *          the heap is extended, and is freed with the block.
+ *
+ * batch: mm_malloc_batch carves n blocks of one size out of a single free
+ *        block (or a single heap extension), and mm_free_batch sorts the
+ *        pointers by address, so that a run of neighbors is merged into one
+ *        free block with one coalesce and one free list insertion.
+ *
+ * threads: the allocator is single-threaded by default. Compiled with
+ *          -DTHREAD_SAFE, the heap is guarded by one lock and every thread
+ *          owns a bounded cache of blocks per request size, so that most
+ *          mm_malloc and mm_free calls take no lock at all. A cache is
+ *          refilled from and flushed to the heap CACHE_BATCH blocks at a
+ *          time, and flushed when its thread exits. mm_init must not run
+ *          concurrently with any other call.
+ *          A thread reads the header of its own block without the lock,
+ *          so the heap words are accessed as relaxed atomics, and no slab
+ *          pages are kept: telling a slot from a block would read words
+ *          that another thread may be writing.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -39,14 +133,64 @@ team_t team = {
 /* private global variables */
 static char *heap_listp;
 static char *freelist_root;
+static char *heap_base;      /* mem_heap_lo(), base of the free list links */
+static char *grow_bp;        /* block grown by the last upward realloc */
+static size_t grow_asize;    /* block size of grow_bp without its headroom */
+static size_t grow_count;    /* upward reallocs of grow_bp in a row */
+static size_t quick_bytes;   /* QUICK_BYTES of every held block */
+static unsigned int purge_clock;  /* heap operations so far */
+static char *purge_head;     /* unpurged tree node freed first */
+static char *purge_tail;     /* unpurged tree node freed last */
+static size_t size_mean;     /* running mean of the heap block sizes requested */
 
 /* private functions */
+static void *heap_malloc(size_t size);
+static void heap_free(void *bp);
+static void block_free(void *bp);
+static void block_free_sized(void *bp, size_t size);
+static void block_release(void *bp);
+static void *heap_realloc(void *ptr, size_t size);
+static void *heap_calloc(size_t size);
+static void *heap_memalign(size_t alignment, size_t size);
+static size_t heap_usable_size(void *ptr);
+static size_t heap_malloc_batch(size_t size, void **ptrs, size_t n);
+static void heap_free_batch(void **ptrs, size_t n);
+static int ptr_cmp(const void *a, const void *b);
 static void *extend_heap(size_t size);
+static void *extend_fit(size_t asize);
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
+static void heap_trim(size_t pad, unsigned int decay);
+static void trim_flush(void);
+static void purge_tick(void);
+static void purge_enqueue(void *bp);
+static void purge_dequeue(void *bp);
 static void place(void *bp, size_t asize);
+static void *place_sized(void *bp, size_t asize);
+static void realloc_place(void *bp, size_t asize);
+static size_t place_batch(void *bp, size_t asize, void **ptrs, size_t n);
+static void *grow_mark(void *bp, size_t asize);
+static void *quick_fit(size_t asize);
+static void quick_hold(void *bp, size_t b);
+static void quick_flush(void);
 static void insert_list(void *bp);
 static void detach_node(void *bp);
+static void *tree_fit(size_t asize);
+static void *tree_insert(void *root, void *bp);
+static void *tree_remove(void *root, void *bp);
+static void *tree_merge(void *left, void *right);
+static void *slab_alloc(size_t size);
+static size_t slab_alloc_batch(size_t size, void **ptrs, size_t n);
+static void *slab_partial(size_t c);
+static void slab_free(void *bp);
+static void *slab_page(size_t slot);
+static void slab_unlink(void *page);
+static void slab_release(void *page);
+static void slab_trim(void);
+static int is_slab(void *bp);
+static void *huge_alloc(size_t size, size_t alignment);
+static void huge_free(void *bp);
+static void *huge_realloc(void *bp, size_t size);
 
 /* heap checker */
 void mm_checkheap(int verbose);
@@ -56,31 +200,78 @@ static void checkblock(void *bp);
 static void printblock(void *bp);
 static void checklist(int verbose);
 static void printlist(void *bp);
+static int checktree(void *root, void *lo, void *hi, int verbose);
+static void checkslab(void *page);
 
 /* basic constants and macros */
 #define WSIZE 4             /* word size (bytes) */
 #define DSIZE 8             /* double word size (bytes) */
 #define CHUNKSIZE (1<<12)   /* extend heap by 4kB */
 #define MAXN 12             /* max size class number */
+#define MAX_REQUEST (1<<30) /* larger requests fail, sizes must fit in an int */
+#define TREE_SIZE (1<<MAXN) /* blocks >= TREE_SIZE are kept in the tree */
+
+/* a free block at the end of the heap is trimmed to TRIM_PAD bytes once
+ * it holds TRIM_THRESHOLD bytes more and has decayed, or at once to
+ * TRIM_THRESHOLD bytes, build with -DTRIM_THRESHOLD=n to tune */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (1<<17)
+#endif
+#define TRIM_PAD CHUNKSIZE
+#define TRIM_FLUSH (1<<16)  /* a free block this large flushes the quick lists */
+
+/* the pages of a free block in the tree are purged PURGE_DECAY heap
+ * operations after it was freed, build with -DPURGE_DECAY=n to tune */
+#ifndef PURGE_DECAY
+#define PURGE_DECAY (1<<12)
+#endif
+#define PURGE_SWEEP (PURGE_DECAY>>2)    /* operations between two sweeps */
+#define PURGE_MIN   (2*CHUNKSIZE + 2*DSIZE)  /* min block with a whole page */
+#define PURGED      0xffffffffU         /* epoch of a purged block */
+
+/* requests of HUGE_MIN bytes or more are mapped outside the heap, build
+ * with -DHUGE_MIN=n to tune */
+#ifndef HUGE_MIN
+#define HUGE_MIN (1<<18)
+#endif
+
+#define MEAN_SHIFT 4        /* size_mean follows about the last 16 requests */
+
+#define GROW_MIN  512       /* min block size given realloc headroom */
+#define GROW_AFTER 1        /* upward reallocs in a row before any headroom */
+#define GROW_SHIFT 1        /* headroom = block size >> GROW_SHIFT */
 
 #define MAX(x, y) ((x) > (y)? (x):(y))
+#define MIN(x, y) ((x) < (y)? (x):(y))
 
-/* pack a size and allocated bit into a word */
-#define PACK(size, alloc) ((size)|(alloc))
+/* pack a size, previous block allocated bit, and allocated bit into a word */
+#define PACK(size, prev_alloc, alloc) ((size)|((prev_alloc)<<1)|(alloc))
 
-/* read and write a word at address p */
+/* read and write a word at address p, the thread-safe build reads the
+ * header of a block without the lock while its prev-alloc bit is updated */
+#ifdef THREAD_SAFE
+#define GETW(p)       __atomic_load_n((unsigned int *)(p), __ATOMIC_RELAXED)
+#define PUTW(p, val)  __atomic_store_n((unsigned int *)(p), (unsigned int)(val), __ATOMIC_RELAXED)
+#else
 #define GETW(p)       (*(unsigned int *)(p))
 #define PUTW(p, val)  (*(unsigned int *)(p) = (unsigned int)(val))
+#endif
 
 /* read the size and allocated fields from address p */
-#define GET_SIZE(p)   (GETW(p) & ~0x7)
-#define GET_ALLOC(p)  (GETW(p) & 0x1)
+#define GET_SIZE(p)       (GETW(p) & ~0x7)
+#define GET_ALLOC(p)      (GETW(p) & 0x1)
+#define GET_PREV_ALLOC(p) ((GETW(p) & 0x2) >> 1)
+
+/* set or clear the previous block allocated bit at address p */
+#define SET_PREV_ALLOC(p)   (PUTW((p), GETW(p) | 0x2))
+#define CLR_PREV_ALLOC(p)   (PUTW((p), GETW(p) & ~0x2))
 
 /* given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)      ((char *)(bp) - WSIZE)
 #define FTRP(bp)      ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* given block ptr bp, compute address of next and previous blocks */
+/* given block ptr bp, compute address of next and previous blocks
+ * Note: PREV_BLKP is only valid if the previous block is free */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
@@ -93,11 +284,141 @@ static void printlist(void *bp);
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* free list links are 32-bit offsets from the first heap byte, so that two
+ * links fit in the 8-byte payload of a min block with 64-bit pointers too.
+ * Offset 0 (the alignment padding word) stands for NULL. */
+#define GET_LINK(p)        link_ptr(GETW(p))
+#define PUT_LINK(p, ptr)   PUTW((p), link_off(ptr))
+
 /* double-linked free list manipulations */
-#define GET_NEXT(bp)       (*(void **)(bp))
-#define PUT_NEXT(bp, ptr)  (*(void **)(bp) = (ptr))
-#define GET_PREV(bp)       (*(void **)((char *)(bp) + 4))
-#define PUT_PREV(bp, ptr)  (*(void **)((char *)(bp) + 4) = (ptr))
+#define GET_NEXT(bp)       GET_LINK(bp)
+#define PUT_NEXT(bp, ptr)  PUT_LINK((bp), (ptr))
+#define GET_PREV(bp)       GET_LINK((char *)(bp) + WSIZE)
+#define PUT_PREV(bp, ptr)  PUT_LINK((char *)(bp) + WSIZE, (ptr))
+
+/* treap manipulations, tree nodes reuse the next and prev words */
+#define GET_LEFT(bp)       GET_LINK(bp)
+#define PUT_LEFT(bp, ptr)  PUT_LINK((bp), (ptr))
+#define GET_RIGHT(bp)      GET_LINK((char *)(bp) + WSIZE)
+#define PUT_RIGHT(bp, ptr) PUT_LINK((char *)(bp) + WSIZE, (ptr))
+
+/* the copy of the header behind the links of a free node, in a min block
+ * it is the footer itself */
+#define NODEP(bp)          ((char *)(bp) + DSIZE)
+#define NODE_SIZE(bp)      GET_SIZE(NODEP(bp))
+
+/* the heap clock when a tree node was freed, PURGED once it is purged */
+#define EPOCHP(bp)         ((char *)(bp) + 3*WSIZE)
+
+/* the purge queue links behind the epoch of a node of PURGE_MIN bytes */
+#define GET_QNEXT(bp)       GET_LINK((char *)(bp) + 4*WSIZE)
+#define PUT_QNEXT(bp, ptr)  PUT_LINK((char *)(bp) + 4*WSIZE, (ptr))
+#define GET_QPREV(bp)       GET_LINK((char *)(bp) + 5*WSIZE)
+#define PUT_QPREV(bp, ptr)  PUT_LINK((char *)(bp) + 5*WSIZE, (ptr))
+#define QUEUED(bp)          ((NODE_SIZE(bp) >= PURGE_MIN) && \
+                             (GETW(EPOCHP(bp)) != PURGED))
+
+/* tree order: by size, then by address, so that every key is unique */
+#define TREE_LESS(a, b) ((NODE_SIZE(a) < NODE_SIZE(b)) || \
+                         ((NODE_SIZE(a) == NODE_SIZE(b)) && \
+                          ((char *)(a) < (char *)(b))))
+
+/* heap priority of a tree node, a multiplicative hash of its address */
+#define PRIO(bp)        ((unsigned int)((size_t)(bp) >> 3) * 2654435761U)
+
+/* a bound of the block sizes in each size class list, see find_fit */
+static unsigned int class_max[MAXN];
+
+/* root of the tree (the slot of the largest size class) */
+#define TREE_ROOT()     GET_NEXT(freelist_root + (WSIZE*MAXN))
+#define PUT_ROOT(ptr)   PUT_NEXT(freelist_root + (WSIZE*MAXN), (ptr))
+
+/* slab pages and slab size classes (slot size 8, 16, 24, 32, 48, 64) */
+#define PAGESIZE    (1<<12)     /* slab page size (bytes) */
+#ifdef THREAD_SAFE
+#define SLAB_MAX    0           /* no slab pages, see threads */
+#else
+#define SLAB_MAX    64          /* max request size served from slabs */
+#endif
+#define SLABN       6           /* number of slab classes */
+#define SLAB_BIT    0x4         /* header bit of a slab page block */
+#define SLAB_MAGIC  0x5ab5ab5a  /* page magic, xor-ed with the page address */
+#define HUGE_BIT    SLAB_BIT    /* header bit of a mapped block */
+
+/* block size of a slab page (header + page + padding to the next payload) */
+#define SLAB_BLKSIZE    (PAGESIZE + DSIZE)
+
+#define SLAB_CLASS(size) ((size) <= 32 ? (((size) + 7) >> 3) - 1 : ((size) <= 48 ? 4 : 5))
+#define SLAB_SLOT(c)     ((c) < 4 ? ((c) + 1) << 3 : ((c) - 1) << 4)
+
+/* list of slab pages with free slots of class c */
+#define SLAB_ROOT(c)     (freelist_root + (WSIZE*(MAXN + 1 + (c))))
+
+/* page ptr of a slab slot, and the page header fields
+ * the next and prev page are kept in the same words as a free list node */
+#define PAGEP(bp)           ((char *)((size_t)(bp) & ~(size_t)(PAGESIZE - 1)))
+#define SLAB_MAGICP(pg)     ((char *)(pg) + (WSIZE*2))
+#define SLAB_SLOTP(pg)      ((char *)(pg) + (WSIZE*3))
+#define SLAB_NFREEP(pg)     ((char *)(pg) + (WSIZE*4))
+#define SLAB_NSLOTSP(pg)    ((char *)(pg) + (WSIZE*5))
+#define SLAB_MAPP(pg, i)    ((char *)(pg) + (WSIZE*(6 + (i))))
+#define SLAB_MAGIC_OF(pg)   ((unsigned int)(size_t)(pg) ^ SLAB_MAGIC)
+
+/* bitmap words and offset of the first slot of a page with slot size s */
+#define SLAB_MAPN(s)        ((PAGESIZE/(s) + 31) / 32)
+#define SLAB_OFFSET(s)      ALIGN(WSIZE*(6 + SLAB_MAPN(s)))
+
+/* huge blocks: the offset of the payload in its mapping, which the header
+ * (with HUGE_BIT) sizes. IS_HUGE is only valid if bp is not a slab slot. */
+#define HUGE_OFFP(bp)       ((char *)(bp) - DSIZE)
+#define IS_HUGE(bp)         (GETW(HDRP(bp)) & HUGE_BIT)
+
+/* quick lists */
+#define QUICK_MAX   (1<<12)         /* blocks smaller than this are held */
+#define QUICK_SHIFT 7               /* one quick list per 128 bytes of block size */
+#define QUICKN      (QUICK_MAX>>QUICK_SHIFT)
+#define QUICK_LIMIT (1<<20)         /* max bytes held before they are flushed */
+#define QUICK_BYTES(b)  (((b) + 1) << QUICK_SHIFT)  /* bytes counted per block in list b */
+#define QUICK_ROOT(b)   (freelist_root + (WSIZE*(MAXN + 1 + SLABN + (b))))
+
+/* convert between a free list link offset and a block ptr */
+static inline void *link_ptr(unsigned int off)
+{
+    return off ? (void *)(heap_base + off) : NULL;
+}
+
+static inline unsigned int link_off(void *ptr)
+{
+    return ptr ? (unsigned int)((char *)ptr - heap_base) : 0;
+}
+
+#ifdef THREAD_SAFE
+/* per-thread cache, bin b holds blocks with a payload of at least (b+1)*8 */
+#define CACHEN       32                      /* number of cache bins */
+#define CACHE_MAX    (CACHEN*ALIGNMENT)      /* max request size served from the cache */
+#define CACHE_LIMIT  64                      /* max blocks kept in a bin */
+#define CACHE_BATCH  16                      /* blocks moved per refill or flush */
+
+/* a request that may end up in a cache bin is rounded up to the bin size */
+#define CACHE_SIZE(size) ((size) <= CACHE_MAX ? ALIGN(size) : (size))
+
+typedef struct {
+    unsigned int gen;               /* heap generation of the cached blocks */
+    void *bins[CACHEN];             /* blocks linked through the first payload word */
+    unsigned int count[CACHEN];     /* number of blocks in each bin */
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;    /* flushes the cache on thread exit */
+static unsigned int heap_gen;       /* bumped by mm_init, stale caches are dropped */
+static __thread tcache_t tcache;
+
+static tcache_t *tcache_get(void);
+static void tcache_flush(tcache_t *tc, size_t b, size_t n);
+static void tcache_exit(void *arg);
+static void tcache_key_init(void);
+#endif
 
 /* 
  * mm_init - initialize the malloc package.
@@ -105,8 +426,22 @@ static void printlist(void *bp);
  */
 int mm_init(void)
 {
+    int c, b;
+
+#ifdef THREAD_SAFE
+    pthread_once(&tcache_once, tcache_key_init);
+    heap_gen++;  /* every cached block belongs to the old heap */
+#endif
+
     /* create the initial empty heap */
-    if((heap_listp = mem_sbrk(16*WSIZE)) == (void *)-1)
+    heap_base = mem_heap_lo();
+    grow_bp = NULL;
+    quick_bytes = 0;
+    purge_clock = 0;
+    purge_head = purge_tail = NULL;
+    size_mean = 0;
+    memset(class_max, 0, sizeof(class_max));
+    if((heap_listp = mem_sbrk((16 + SLABN + QUICKN)*WSIZE)) == (void *)-1)
         return -1;
     PUTW(heap_listp, 0);                 /* alignment padding */  /* <- freelist_root */
     /* initialize seglist, for n block, 2^n <= size < 2^(n+1) */  
@@ -121,12 +456,19 @@ int mm_init(void)
     PUTW(heap_listp + (WSIZE*9), 0);     /* block size < 1024 */
     PUTW(heap_listp + (WSIZE*10), 0);    /* block size < 2048 */
     PUTW(heap_listp + (WSIZE*11), 0);    /* block size < 4096 */
-    PUTW(heap_listp + (WSIZE*12), 0);    /* block size >= 4096 */
-    PUTW(heap_listp + (WSIZE*13), PACK(DSIZE, 1));  /* prologue header */
-    PUTW(heap_listp + (WSIZE*14), PACK(DSIZE, 1));  /* prologue footer */  /* <- heap_listp */
-    PUTW(heap_listp + (WSIZE*15), PACK(0, 1));      /* epilogue header */
-
-    freelist_root = heap_listp;         /* init the freelist_root ptr */
+    PUTW(heap_listp + (WSIZE*12), 0);    /* block size >= 4096 (tree root) */
+    /* initialize the list of partial slab pages of every slab class */
+    for(c = 0; c < SLABN; c++)
+        PUTW(heap_listp + (WSIZE*(13 + c)), 0);
+    /* initialize the quick lists */
+    for(b = 0; b < QUICKN; b++)
+        PUTW(heap_listp + (WSIZE*(13 + SLABN + b)), 0);
+    heap_listp += (WSIZE*(SLABN + QUICKN));
+    PUTW(heap_listp + (WSIZE*13), PACK(DSIZE, 1, 1));  /* prologue header */
+    PUTW(heap_listp + (WSIZE*14), PACK(DSIZE, 1, 1));  /* prologue footer */  /* <- heap_listp */
+    PUTW(heap_listp + (WSIZE*15), PACK(0, 1, 1));      /* epilogue header */
+
+    freelist_root = heap_listp - (WSIZE*(SLABN + QUICKN));  /* init the freelist_root ptr */
     heap_listp += (WSIZE*14);
 
     /* extend the empty heap size (bytes) */
@@ -137,107 +479,772 @@ int mm_init(void)
 }
 
 /* 
- * mm_malloc - 
- * Always allocate a block whose size is a multiple of the alignment.
+ * mm_malloc - allocate a block of at least size bytes.
+ * The thread-safe build serves small requests from the thread cache.
  */
 void *mm_malloc(size_t size)
+{
+#ifdef THREAD_SAFE
+    tcache_t *tc;
+    char *bp;
+    size_t b, n;
+
+    if(size == 0)
+        return NULL;
+    if(size > CACHE_MAX) {
+        pthread_mutex_lock(&heap_lock);
+        bp = heap_malloc(size);
+        pthread_mutex_unlock(&heap_lock);
+        return bp;
+    }
+
+    tc = tcache_get();
+    b = (ALIGN(size) >> 3) - 1;
+    if(tc->bins[b] == NULL) {  /* refill the bin in one batch */
+        pthread_mutex_lock(&heap_lock);
+        for(n = 0; n < CACHE_BATCH; n++) {
+            if((bp = heap_malloc((b + 1) << 3)) == NULL)
+                break;
+            PUT_NEXT(bp, tc->bins[b]);
+            tc->bins[b] = bp;
+            tc->count[b]++;
+        }
+        pthread_mutex_unlock(&heap_lock);
+        if(tc->bins[b] == NULL)
+            return NULL;
+    }
+
+    bp = tc->bins[b];
+    tc->bins[b] = GET_NEXT(bp);
+    tc->count[b]--;
+    return bp;
+#else
+    return heap_malloc(size);
+#endif
+}
+
+/*
+ * mm_free - free a block returned by mm_malloc or mm_realloc.
+ * The thread-safe build keeps small blocks in the thread cache.
+ */
+void mm_free(void *bp)
+{
+#ifdef THREAD_SAFE
+    tcache_t *tc;
+    size_t b;
+
+    /* bin of the payload size, no block is a slab slot */
+    b = ((GET_SIZE(HDRP(bp)) - WSIZE) >> 3) - 1;
+
+    if(b >= CACHEN) {
+        pthread_mutex_lock(&heap_lock);
+        heap_free(bp);
+        pthread_mutex_unlock(&heap_lock);
+        return;
+    }
+
+    tc = tcache_get();
+    PUT_NEXT(bp, tc->bins[b]);
+    tc->bins[b] = bp;
+    if(++tc->count[b] > CACHE_LIMIT)
+        tcache_flush(tc, b, CACHE_BATCH);
+#else
+    heap_free(bp);
+#endif
+}
+
+/*
+ * mm_free_sized - free a block whose size is known to the caller, as with
+ * a sized operator delete. size must be the size the block was allocated
+ * or last resized with. The size picks the path without decoding the
+ * header: only a block of at most SLAB_MAX bytes may be a slab slot, a
+ * larger one is held in the quick list of its size (see block_free_sized),
+ * and the thread-safe build picks the cache bin by size (every small block
+ * holds its size rounded up to the bin size, see CACHE_SIZE). The size is checked
+ * against the block only in debug builds (without -DNDEBUG).
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+#ifdef THREAD_SAFE
+    tcache_t *tc;
+    size_t b;
+#endif
+
+    if(bp == NULL)
+        return;
+    assert(size <= (is_slab(bp) ? GETW(SLAB_SLOTP(PAGEP(bp))) : GET_SIZE(HDRP(bp)) - WSIZE));
+
+#ifdef THREAD_SAFE
+    if(size == 0 || size > CACHE_MAX) {
+        pthread_mutex_lock(&heap_lock);
+        if(size > SLAB_MAX)
+            block_free_sized(bp, size);
+        else
+            heap_free(bp);
+        pthread_mutex_unlock(&heap_lock);
+        return;
+    }
+
+    tc = tcache_get();
+    b = (ALIGN(size) >> 3) - 1;
+    PUT_NEXT(bp, tc->bins[b]);
+    tc->bins[b] = bp;
+    if(++tc->count[b] > CACHE_LIMIT)
+        tcache_flush(tc, b, CACHE_BATCH);
+#else
+    if(size > SLAB_MAX)
+        block_free_sized(bp, size);
+    else
+        heap_free(bp);
+#endif
+}
+
+/*
+ * mm_realloc - resize the block, see heap_realloc.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+#ifdef THREAD_SAFE
+    char *bp;
+
+    if(ptr == NULL)
+        return mm_malloc(size);
+    if(size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    bp = heap_realloc(ptr, CACHE_SIZE(size));
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+#else
+    return heap_realloc(ptr, size);
+#endif
+}
+
+/*
+ * mm_calloc - allocate a zeroed array of nmemb elements of size bytes.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+#ifdef THREAD_SAFE
+    char *bp;
+#endif
+
+    /* the array size must not overflow */
+    if((nmemb != 0) && (size > (size_t)-1 / nmemb))
+        return NULL;
+    size *= nmemb;
+
+#ifdef THREAD_SAFE
+    if(size <= CACHE_MAX) {
+        if((bp = mm_malloc(size)) != NULL)
+            memset(bp, 0, size);
+        return bp;
+    }
+    pthread_mutex_lock(&heap_lock);
+    bp = heap_calloc(size);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+#else
+    return heap_calloc(size);
+#endif
+}
+
+/*
+ * mm_memalign - allocate a block whose payload address is a multiple of
+ * alignment, which must be a power of two.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+#ifdef THREAD_SAFE
+    char *bp;
+
+    pthread_mutex_lock(&heap_lock);
+    bp = heap_memalign(alignment, CACHE_SIZE(size));
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+#else
+    return heap_memalign(alignment, size);
+#endif
+}
+
+/*
+ * mm_posix_memalign - mm_memalign with the posix_memalign interface.
+ * return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    /* alignment must be a power of two multiple of sizeof(void *) */
+    if((alignment == 0) || (alignment & (alignment - 1)) || (alignment % sizeof(void *)))
+        return EINVAL;
+    if(((bp = mm_memalign(alignment, size)) == NULL) && (size != 0))
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_usable_size - the number of bytes that can be used in the block ptr,
+ * at least the size it was requested with.
+ */
+size_t mm_usable_size(void *ptr)
+{
+#ifdef THREAD_SAFE
+    size_t size;
+
+    pthread_mutex_lock(&heap_lock);
+    size = heap_usable_size(ptr);
+    pthread_mutex_unlock(&heap_lock);
+    return size;
+#else
+    return heap_usable_size(ptr);
+#endif
+}
+
+/*
+ * mm_malloc_batch - allocate n blocks of at least size bytes each into
+ * ptrs, return the number of blocks allocated (less than n if out of memory).
+ * The thread-safe build hands out the blocks of the thread cache first.
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+#ifdef THREAD_SAFE
+    tcache_t *tc;
+    size_t b, k = 0;
+
+    if(size == 0)
+        return 0;
+    if(size <= CACHE_MAX) {
+        tc = tcache_get();
+        b = (ALIGN(size) >> 3) - 1;
+        while(k < n && tc->bins[b] != NULL) {
+            ptrs[k] = tc->bins[b];
+            tc->bins[b] = GET_NEXT(ptrs[k]);
+            tc->count[b]--;
+            k++;
+        }
+    }
+    if(k < n) {
+        pthread_mutex_lock(&heap_lock);
+        k += heap_malloc_batch(CACHE_SIZE(size), ptrs + k, n - k);
+        pthread_mutex_unlock(&heap_lock);
+    }
+    return k;
+#else
+    return heap_malloc_batch(size, ptrs, n);
+#endif
+}
+
+/*
+ * mm_free_batch - free the n blocks in ptrs, NULL entries are skipped.
+ * Note: ptrs is reordered in place.
+ * The thread-safe build fills the thread cache first, the rest of the
+ * blocks are freed under one lock.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+#ifdef THREAD_SAFE
+    tcache_t *tc = tcache_get();
+    char *bp;
+    size_t b, i, k = 0;
+
+    for(i = 0; i < n; i++) {
+        if((bp = ptrs[i]) == NULL)
+            continue;
+        b = ((GET_SIZE(HDRP(bp)) - WSIZE) >> 3) - 1;
+        if(b < CACHEN && tc->count[b] < CACHE_LIMIT) {
+            PUT_NEXT(bp, tc->bins[b]);
+            tc->bins[b] = bp;
+            tc->count[b]++;
+        }
+        else
+            ptrs[k++] = bp;  /* left for the heap */
+    }
+    if(k > 0) {
+        pthread_mutex_lock(&heap_lock);
+        heap_free_batch(ptrs, k);
+        pthread_mutex_unlock(&heap_lock);
+    }
+#else
+    heap_free_batch(ptrs, n);
+#endif
+}
+
+/* 
+ * heap_malloc - 
+ * Always allocate a block whose size is a multiple of the alignment.
+ */
+static void *heap_malloc(size_t size)
 {
     size_t asize;
-    size_t extendsize;
     char *bp;
 
     /* ignore spurious requests */
-    if(size == 0)
+    if((size == 0) || (size > MAX_REQUEST))
         return NULL;
 
+    purge_tick();
+
+    if(size >= HUGE_MIN)
+        return huge_alloc(size, PAGESIZE);
+
+    /* tiny requests are served from the slab pages */
+    if(size <= SLAB_MAX)
+        return slab_alloc(size);
+
     /* min block size = 4 words (header + footer + 2 words free block) */
-    if(size <= DSIZE)
+    if(size <= 3*WSIZE)
         asize = 2*DSIZE;
     else
-        asize = ALIGN(size + 2*WSIZE);
+        asize = ALIGN(size + WSIZE);  /* allocated blocks have no footer */
+
+    /* reuse a block held in the quick list of this size */
+    if((asize < QUICK_MAX) && ((bp = quick_fit(asize)) != NULL))
+        return (void *)bp;
+
+    size_mean += (asize >> MEAN_SHIFT) - (size_mean >> MEAN_SHIFT);
 
     /* search the free list for a fit */
     if((bp = find_fit(asize)) != NULL) {
         detach_node(bp);
-        place(bp, asize);
-        return (void *)bp;
+        return place_sized(bp, asize);
+    }
+
+    /* take the headroom of the growing block back before extending the heap */
+    if((grow_bp != NULL) && (GET_SIZE(HDRP(grow_bp)) - grow_asize >= 2*DSIZE)) {
+        realloc_place(grow_bp, grow_asize);
+        if((bp = find_fit(asize)) != NULL) {
+            detach_node(bp);
+            return place_sized(bp, asize);
+        }
     }
 
     /* no fit found, extend heap to place the block */
-    extendsize = MAX(asize, CHUNKSIZE);
-    if((bp = extend_heap(extendsize)) == NULL)
+    if((bp = extend_fit(asize)) == NULL)
         return NULL;
 
-    detach_node(bp);
-    place(bp, asize);
-    return (void *)bp;
+    return place_sized(bp, asize);
 }
 
 /*
- * mm_free - Freeing a block and coalesce prev/next free block if exist.
+ * heap_free - Freeing a block and coalesce prev/next free block if exist.
  */
-void mm_free(void *bp)
+static void heap_free(void *bp)
+{
+    if(is_slab(bp))
+        slab_free(bp);
+    else
+        block_free(bp);
+}
+
+/*
+ * block_free - free a block that is not a slab slot, a small block is held
+ * in its quick list (still allocated) rather than coalesced, unless only
+ * a free block lies between it and the end of the heap. A huge block is
+ * unmapped.
+ */
+static void block_free(void *bp)
 {
     size_t size = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+
+    if(IS_HUGE(bp)) {
+        huge_free(bp);
+        return;
+    }
+    if(bp == grow_bp)
+        grow_bp = NULL;  /* the headroom goes with the block */
+
+    purge_tick();
+    if(!GET_ALLOC(HDRP(next)))
+        next = NEXT_BLKP(next);
+    if((size < QUICK_MAX) && (GET_SIZE(HDRP(next)) != 0)) {
+        quick_hold(bp, size >> QUICK_SHIFT);
+        return;
+    }
+    block_release(bp);
+}
+
+/*
+ * block_free_sized - block_free of a block that is not a slab slot, with
+ * the size it was requested with. A small block is held in the quick list
+ * of that size without decoding its header or reading its neighbors, so it
+ * may be held in a list below its block size, or next to the end of the
+ * heap until the next flush. A huge block may be small (see heap_memalign),
+ * only its header bit is read to unmap it.
+ */
+static void block_free_sized(void *bp, size_t size)
+{
+    size_t asize = (size <= 3*WSIZE) ? 2*DSIZE : ALIGN(size + WSIZE);
+
+    if((asize >= QUICK_MAX) || (bp == grow_bp) || IS_HUGE(bp)) {
+        block_free(bp);
+        return;
+    }
+    purge_tick();
+    quick_hold(bp, asize >> QUICK_SHIFT);
+}
 
-    PUTW(HDRP(bp), PACK(size, 0));
-    PUTW(FTRP(bp), PACK(size, 0));
+/*
+ * block_release - mark the block free, coalesce it and insert it to the
+ * free list, a large free block trims the end of the heap at once
+ */
+static void block_release(void *bp)
+{
+    size_t size, prev_alloc;
+
+    size = GET_SIZE(HDRP(bp));
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    PUTW(HDRP(bp), PACK(size, prev_alloc, 0));
+    PUTW(FTRP(bp), PACK(size, prev_alloc, 0));
+    /* update the prev_alloc bit of the next block */
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
 
     bp = coalesce(bp);
     insert_list(bp);
+    if(GET_SIZE(HDRP(bp)) >= TRIM_FLUSH) {
+        trim_flush();
+        heap_trim(TRIM_THRESHOLD, 0);
+    }
 }
 
 /*
- * mm_realloc - use previous and next block if it is free.
- * First coalesce the prev and next block, then check the size of the new block
- * if block size > size, use this block
- * if block size < size, malloc a new block and re-insert the old block to free list
+ * heap_realloc - use previous and next block if it is free.
+ * First try to shrink or grow the block into the next free block in place,
+ * then try to slide the content down into (prev + old + next) block,
+ * otherwise malloc a new block and free the old block.
+ *
+ * Note: the old block has no footer, so no free block footer may be written
+ * over the old content before it has been moved.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void *heap_realloc(void *ptr, size_t size)
 {
     char *bp, *new_bp;
-    size_t old_size = GET_SIZE(HDRP(ptr));
-    size = ALIGN(size + 2*WSIZE);
+    size_t old_size, asize, need, fsize, prev_alloc, next_alloc;
 
-    /* ignore spurious requests */
-    if(ptr == NULL && size == 0) {
-        return NULL;
-    }
     /* if ptr is NULL, the call is equivalent to mm malloc(size) */
-    else if(ptr == NULL) {
-        return mm_malloc(size);
+    if(ptr == NULL) {
+        return heap_malloc(size);
     }
     /* if size is equal to zero, the call is equivalent to mm free(ptr) */
     else if(size == 0) {
-        mm_free(ptr);
+        heap_free(ptr);
+        return NULL;
+    }
+    if(size > MAX_REQUEST)
+        return NULL;
+    purge_tick();
+
+    /* a slab slot is kept if the new size still fits in the slot */
+    if(is_slab(ptr)) {
+        old_size = GETW(SLAB_SLOTP(PAGEP(ptr)));
+        if(size <= old_size)
+            return ptr;
+        if((new_bp = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(new_bp, ptr, old_size);
+        slab_free(ptr);
+        return (void *)new_bp;
+    }
+    if(IS_HUGE(ptr))
+        return huge_realloc(ptr, size);
+
+    old_size = GET_SIZE(HDRP(ptr));
+    if(size <= 3*WSIZE)
+        asize = 2*DSIZE;
+    else
+        asize = ALIGN(size + WSIZE);
+
+    /* count the upward reallocs of the same block in a row, a request that
+     * still fits in the headroom of the growing block is served as is */
+    if(asize > old_size)
+        grow_count = (ptr == grow_bp) ? grow_count + 1 : 1;
+    else if((ptr == grow_bp) && (asize >= grow_asize)) {
+        grow_asize = asize;
+        return ptr;
+    }
+    grow_bp = NULL;
+
+    /* a block that keeps growing is given geometric headroom */
+    need = asize;
+    if((asize > old_size) && (grow_count > GROW_AFTER) && (asize >= GROW_MIN))
+        asize += ALIGN(asize >> GROW_SHIFT);
+    if(asize - WSIZE >= HUGE_MIN)
+        asize = need;  /* a mapped block needs no headroom */
+
+    prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
+    next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
+    fsize = old_size;
+    if(!next_alloc)
+        fsize += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
+
+    /* shrink the block in place */
+    if(old_size >= asize) {
+        realloc_place(ptr, asize);
+        return ptr;
+    }
+
+    /* use (old + next) block in place */
+    if(fsize >= need) {
+        detach_node(NEXT_BLKP(ptr));
+        PUTW(HDRP(ptr), PACK(fsize, prev_alloc, 1));
+        realloc_place(ptr, MIN(asize, fsize));
+        return grow_mark(ptr, need);
+    }
+
+    /* use (prev + old + next) block, move the content to the prev block */
+    if(!prev_alloc && (fsize + GET_SIZE(HDRP(PREV_BLKP(ptr)))) >= need) {
+        bp = PREV_BLKP(ptr);
+        fsize += GET_SIZE(HDRP(bp));
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        detach_node(bp);
+        if(!next_alloc)
+            detach_node(NEXT_BLKP(ptr));
+        memmove(bp, ptr, (old_size - WSIZE));
+        PUTW(HDRP(bp), PACK(fsize, prev_alloc, 1));
+        realloc_place(bp, MIN(asize, fsize));
+        return grow_mark(bp, need);
+    }
+
+    /* the block ends the heap (maybe followed by a free block), extend the
+     * heap by the missing bytes only and grow the block in place */
+    bp = NEXT_BLKP(ptr);
+    if(!next_alloc)
+        bp = NEXT_BLKP(bp);
+    if((GET_SIZE(HDRP(bp)) == 0) && (extend_heap(MAX(need - fsize, 2*DSIZE)) != NULL)) {
+        bp = NEXT_BLKP(ptr);  /* the new free block, merged with the old next */
+        detach_node(bp);
+        PUTW(HDRP(ptr), PACK(old_size + GET_SIZE(HDRP(bp)), prev_alloc, 1));
+        realloc_place(ptr, need);
+        return grow_mark(ptr, need);
+    }
+
+    /* realloc a new block */
+    if((new_bp = heap_malloc(asize - WSIZE)) == NULL)
+        return NULL;
+    memcpy(new_bp, ptr, (old_size - WSIZE));
+    heap_free(ptr);
+    if(size >= HUGE_MIN)
+        return new_bp;  /* mapped, it grows with mem_remap from now on */
+    return grow_mark(new_bp, need);
+}
+
+/*
+ * heap_calloc - return a zeroed block, a huge block is freshly mapped and
+ * the heap past its old end is zero-filled by mem_sbrk, so neither is cleared
+ */
+static void *heap_calloc(size_t size)
+{
+    char *bp, *end, *ftr;
+
+    if(size >= HUGE_MIN)
+        return heap_malloc(size);
+    end = (char *)mem_heap_hi() + 1;
+    if((bp = heap_malloc(size)) == NULL)
+        return NULL;
+
+    if((size <= SLAB_MAX) || (bp + size <= end)) {
+        memset(bp, 0, size);
+        return bp;
+    }
+    /* past the old end only the free block words at bp and its footer were written */
+    memset(bp, 0, MIN(size, ((bp < end) ? (size_t)(end - bp) : 0) + 6*WSIZE));
+    ftr = (char *)mem_heap_hi() + 1 - DSIZE;
+    if(bp + size > ftr)
+        PUTW(ftr, 0);
+    return bp;
+}
+
+/*
+ * heap_memalign - a block is allocated with room for the alignment, then
+ * the slack in front of the aligned payload is split off and freed, and so
+ * is the slack behind it.
+ */
+static void *heap_memalign(size_t alignment, size_t size)
+{
+    char *bp, *p;
+    size_t asize, lead, prev_alloc;
+
+    if((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if(alignment <= ALIGNMENT)
+        return heap_malloc(size);
+    if((size == 0) || (size > MAX_REQUEST) || (alignment > MAX_REQUEST))
+        return NULL;
+
+    if(size <= 3*WSIZE)
+        asize = 2*DSIZE;
+    else
+        asize = ALIGN(size + WSIZE);
+
+    /* map the block if the request with its slack would be mapped anyway */
+    if(asize + alignment + 2*DSIZE >= HUGE_MIN)
+        return huge_alloc(size, alignment);
+
+    /* the lead must hold a min free block, and slab slots are not aligned */
+    if((bp = heap_malloc(MAX(asize + alignment + 2*DSIZE, SLAB_MAX + 1))) == NULL)
         return NULL;
+
+    p = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+    if(p != bp) {
+        if(p - bp < 2*DSIZE)
+            p += alignment;
+        lead = p - bp;
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        PUTW(HDRP(p), PACK(GET_SIZE(HDRP(bp)) - lead, 1, 1));
+        PUTW(HDRP(bp), PACK(lead, prev_alloc, 1));
+        block_release(bp);  /* the lead coalesces, no quick list holds it */
     }
+    realloc_place(p, asize);
+    return p;
+}
+
+/*
+ * heap_usable_size - payload size of the block (or slab slot) ptr
+ */
+static size_t heap_usable_size(void *ptr)
+{
+    if(ptr == NULL)
+        return 0;
+    if(is_slab(ptr))
+        return GETW(SLAB_SLOTP(PAGEP(ptr)));
+    if(IS_HUGE(ptr))
+        return GET_SIZE(HDRP(ptr)) - GETW(HUGE_OFFP(ptr));
+
+    /* the caller may now use the headroom, it is no longer reclaimable */
+    if(ptr == grow_bp)
+        grow_bp = NULL;
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * heap_malloc_batch - a free block that holds all n blocks is carved up at
+ * once. Otherwise the blocks are carved from the best fits one free block
+ * at a time, and the heap is extended once by all blocks left over.
+ * Should that fail, the rest is allocated one by one while memory lasts.
+ */
+static size_t heap_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t asize, k = 0;
+    char *bp;
 
-    bp = coalesce(ptr);  /* coalesce prev and next free block if exist */
+    if(size == 0 || n == 0 || size > MAX_REQUEST)
+        return 0;
+
+    if(size <= SLAB_MAX)
+        return slab_alloc_batch(size, ptrs, n);
+
+    if(size <= 3*WSIZE)
+        asize = 2*DSIZE;
+    else
+        asize = ALIGN(size + WSIZE);
 
-    if(GET_SIZE(HDRP(bp)) >= size) {  /* use (prev + old + next) block */
-        if(bp != ptr) {  /* move the content if prev block is used */
-            memmove(bp, ptr, ((old_size > size)? (size - 2*WSIZE):(old_size - 2*WSIZE)));
+    /* huge blocks are mapped one by one below */
+    if((size < HUGE_MIN) && (n <= INT_MAX / asize)) {  /* mem_sbrk takes the total as an int */
+        if((bp = find_fit(asize * n)) != NULL) {
+            detach_node(bp);
+            return place_batch(bp, asize, ptrs, n);
         }
-            place(bp, size);
-            return bp;
+        while(k < n && (bp = find_fit(asize)) != NULL) {
+            detach_node(bp);
+            k += place_batch(bp, asize, ptrs + k, n - k);
+        }
+        if(k < n && (bp = extend_fit(asize * (n - k))) != NULL)
+            k += place_batch(bp, asize, ptrs + k, n - k);
     }
-    else { /* realloc a new block */
-        if((new_bp = mm_malloc(size)) == NULL)
-            return NULL;
-        memmove(new_bp, ptr, (old_size - 2*WSIZE));
-        insert_list(bp);  /* re-insert the old block to the free list */
-        return (void *)new_bp;
+
+    for(; k < n; k++) {
+        if((ptrs[k] = heap_malloc(size)) == NULL)
+            break;
+    }
+    return k;
+}
+
+/*
+ * heap_free_batch - free the blocks in address order, a run of blocks that
+ * are next to each other becomes one free block before it is coalesced
+ * with its neighbors and inserted to the free list.
+ */
+static void heap_free_batch(void **ptrs, size_t n)
+{
+    char *bp;
+    size_t i, k, size, prev_alloc;
+
+    /* slab slots and huge blocks need no order, the other blocks are kept
+     * in front */
+    for(i = k = 0; i < n; i++) {
+        if((bp = ptrs[i]) == NULL)
+            continue;
+        if(is_slab(bp))
+            slab_free(bp);
+        else if(IS_HUGE(bp))
+            huge_free(bp);
+        else {
+            purge_tick();
+            ptrs[k++] = bp;
+        }
+    }
+    n = k;
+
+    /* sort unless the blocks come in address order already */
+    for(i = 1; i < n && (char *)ptrs[i-1] <= (char *)ptrs[i]; i++)
+        ;
+    if(i < n)
+        qsort(ptrs, n, sizeof(void *), ptr_cmp);
+
+    for(i = 0; i < n; i++) {
+        bp = ptrs[i];
+        if(bp == grow_bp)
+            grow_bp = NULL;
+
+        size = GET_SIZE(HDRP(bp));
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        while(i + 1 < n && (char *)ptrs[i+1] == bp + size) {
+            if(ptrs[++i] == grow_bp)
+                grow_bp = NULL;
+            size += GET_SIZE(HDRP(ptrs[i]));
+        }
+        PUTW(HDRP(bp), PACK(size, prev_alloc, 0));
+        PUTW(FTRP(bp), PACK(size, prev_alloc, 0));
+        CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+        bp = coalesce(bp);
+        insert_list(bp);
+        if(GET_SIZE(HDRP(bp)) >= TRIM_FLUSH) {
+            trim_flush();
+            heap_trim(TRIM_THRESHOLD, 0);
+        }
     }
 }
 
+/*
+ * ptr_cmp - qsort comparator of block pointers by address
+ */
+static int ptr_cmp(const void *a, const void *b)
+{
+    char *p = *(char * const *)a;
+    char *q = *(char * const *)b;
+
+    return (p > q) - (p < q);
+}
+
 /* 
  * mm_checkheap - Check the heap for correctness
  * This function is meant to be called through gdb
  */
 void mm_checkheap(int verbose)  
 { 
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+    checkheap(verbose);
+    pthread_mutex_unlock(&heap_lock);
+#else
     checkheap(verbose);
+#endif
 }
 
 /* 
@@ -246,7 +1253,13 @@ void mm_checkheap(int verbose)
  */
 void mm_checklist(int verbose)  
 { 
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
     checklist(verbose);
+    pthread_mutex_unlock(&heap_lock);
+#else
+    checklist(verbose);
+#endif
 }
 
 /* 
@@ -256,21 +1269,24 @@ void mm_checklist(int verbose)
 /* 
  * The extend_heap function is invoked in two different circumstances:
  * (1) when the heap is initialized
- * (2) when mm_malloc is unable to find a suitable fit.
+ * (2) when heap_malloc is unable to find a suitable fit.
  */
 static void *extend_heap(size_t size)
 {
     char *bp;
+    size_t prev_alloc;
 
-    /* allocate an even number of words to maintain allignment */
+    /* allocate an even number of words to maintain allignment,
+     * a size beyond INT_MAX would reach mem_sbrk as a shrink */
     size  =  ALIGN(size);
-    if((bp = mem_sbrk(size)) == (void *)-1)
+    if((size > INT_MAX) || ((bp = mem_sbrk(size)) == (void *)-1))
         return NULL;
 
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     /* initialize free block header and footer and the epilogue header */
-    PUTW(HDRP(bp), PACK(size, 0));          /* free block header */
-    PUTW(FTRP(bp), PACK(size, 0));          /* free block footer */
-    PUTW(HDRP(NEXT_BLKP(bp)), PACK(0, 1));  /* new epilogue header */
+    PUTW(HDRP(bp), PACK(size, prev_alloc, 0));  /* free block header */
+    PUTW(FTRP(bp), PACK(size, prev_alloc, 0));  /* free block footer */
+    PUTW(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));   /* new epilogue header */
 
     /* coalesce if the previous block was free */
     bp = coalesce(bp);
@@ -281,15 +1297,41 @@ static void *extend_heap(size_t size)
     return bp;
 }
 
+/*
+ * extend_fit - extend the heap so that the free block at its end holds
+ * asize bytes. A free block at the end of the heap is merged with the new
+ * space and makes up for part of it. The block is returned detached from
+ * the free list.
+ */
+static void *extend_fit(size_t asize)
+{
+    size_t extendsize = asize;
+    char *bp, *end;
+
+    end = (char *)mem_heap_hi() + 1;
+    if(!GET_PREV_ALLOC(HDRP(end)))
+        extendsize -= GET_SIZE(HDRP(PREV_BLKP(end)));
+    extendsize = MAX(extendsize, CHUNKSIZE);
+    if((bp = extend_heap(extendsize)) == NULL)
+        return NULL;
+
+    detach_node(bp);
+    return bp;
+}
+
 /*
  * find_fit - best-fit search
+ * The size class lists are searched first, then the tree of large blocks.
+ * A list is skipped if class_max says that no block in it fits, a search
+ * that walks a list to its end without a fit lowers the bound to the
+ * largest block seen.
  */
 static void *find_fit(size_t asize)
 {
-    char *bp;
+    char *bp, *next;
     char *size_class = NULL;
     size_t size = asize;
-    size_t n = 0;
+    size_t n = 0, max;
 
     /* calculate the size class n */
     while(size > 1 && n < MAXN) {
@@ -298,23 +1340,28 @@ static void *find_fit(size_t asize)
     }
     size_class = freelist_root + (WSIZE*n);
 
-    /* jump to next size class if current list is empty */
-    while(GET_NEXT(size_class) == NULL) {
-        size_class += WSIZE;
-        /* if all size class is empty */
-        if(size_class > (freelist_root + MAXN*WSIZE))
-            return NULL;
-    }
-
-    while(size_class <= (freelist_root + MAXN*WSIZE)) {
-        for(bp = GET_NEXT(size_class); bp != NULL; bp = GET_NEXT(bp)) {
-            if(asize <= GET_SIZE(HDRP(bp)))
-                return (void *)bp;
+    while(size_class < (freelist_root + MAXN*WSIZE)) {
+        if(asize <= class_max[n]) {
+            max = 0;
+            for(bp = GET_NEXT(size_class); bp != NULL; bp = next) {
+                next = GET_NEXT(bp);
+                __builtin_prefetch(next);  /* fetch the next node during the test */
+                if(asize <= NODE_SIZE(bp))
+                    return (void *)bp;
+                max = MAX(max, NODE_SIZE(bp));
+            }
+            class_max[n] = max;
         }
         size_class += WSIZE;  /* jump to next size class */
+        n++;
     }
 
-    return NULL;  /* no fit */
+    /* the held blocks may coalesce into a fit */
+    if(((bp = tree_fit(asize)) == NULL) && (quick_bytes > 0)) {
+        quick_flush();
+        return find_fit(asize);
+    }
+    return bp;
 }
 
 /*
@@ -329,57 +1376,198 @@ static void *find_fit(size_t asize)
 static void place(void *bp, size_t asize)
 {   
     size_t fsize = GET_SIZE(HDRP(bp));  /* size of the choosed free block */
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 
     /* if the remainder of the free block > required min block size (4 words) */
     if((fsize - asize) >= (2*DSIZE)) {
-        PUTW(HDRP(bp), PACK(asize, 1));  /* allocated block header */
-        PUTW(FTRP(bp), PACK(asize, 1));  /* allocated block footer */
+        PUTW(HDRP(bp), PACK(asize, prev_alloc, 1));  /* allocated block header */
         fsize -= asize;                  /* size of the remainder of the free block */
         bp = NEXT_BLKP(bp);              /* point bp to the remainder */
-        PUTW(HDRP(bp), PACK(fsize, 0));  /* new free block header */
-        PUTW(FTRP(bp), PACK(fsize, 0));  /* new free block footer */
+        PUTW(HDRP(bp), PACK(fsize, 1, 0));  /* new free block header */
+        PUTW(FTRP(bp), PACK(fsize, 1, 0));  /* new free block footer */
         /* update the segregated free list */
         insert_list(bp);
     }
     else {  /* use the whole free block without splitting */
-        PUTW(HDRP(bp), PACK(fsize, 1));  /* allocated block header */
-        PUTW(FTRP(bp), PACK(fsize, 1));  /* allocated block footer */
+        PUTW(HDRP(bp), PACK(fsize, prev_alloc, 1));  /* allocated block header */
+        /* update the prev_alloc bit of the next block */
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    }
+}
+
+/*
+ * place_sized - place a block of asize bytes in the detached free block bp,
+ * at its high end if asize is clearly (by an eighth) larger than size_mean,
+ * else at its low end like place, so that a run of one size is not split
+ * between the two ends. Return the allocated block.
+ */
+static void *place_sized(void *bp, size_t asize)
+{
+    size_t fsize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    if((asize - (asize >> 3) <= size_mean) || ((fsize - asize) < (2*DSIZE))) {
+        place(bp, asize);
+        return bp;
+    }
+
+    /* the remainder keeps the low end */
+    fsize -= asize;
+    PUTW(HDRP(bp), PACK(fsize, prev_alloc, 0));
+    PUTW(FTRP(bp), PACK(fsize, prev_alloc, 0));
+    insert_list(bp);
+    bp = NEXT_BLKP(bp);
+    PUTW(HDRP(bp), PACK(asize, 0, 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    return bp;
+}
+
+/* 
+ * realloc_place - same as place, but bp is an allocated block whose next
+ * block may be free or may still have the prev_alloc bit cleared.
+ */
+static void realloc_place(void *bp, size_t asize)
+{   
+    size_t fsize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    if((fsize - asize) >= (2*DSIZE)) {
+        PUTW(HDRP(bp), PACK(asize, prev_alloc, 1));  /* allocated block header */
+        fsize -= asize;
+        bp = NEXT_BLKP(bp);
+        PUTW(HDRP(bp), PACK(fsize, 1, 0));  /* new free block header */
+        PUTW(FTRP(bp), PACK(fsize, 1, 0));  /* new free block footer */
+        CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        /* the remainder may border a free block when shrinking */
+        bp = coalesce(bp);
+        insert_list(bp);
+    }
+    else {
+        PUTW(HDRP(bp), PACK(fsize, prev_alloc, 1));  /* allocated block header */
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    }
+}
+
+/*
+ * place_batch - carve up to n blocks of asize bytes from the front of the
+ * detached free block bp (of at least asize bytes) into ptrs, return the
+ * number of blocks. Only the last block is placed with place, which splits
+ * off the remainder.
+ */
+static size_t place_batch(void *bp, size_t asize, void **ptrs, size_t n)
+{
+    size_t fsize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t k;
+
+    for(k = 0; k < n - 1 && fsize >= 2*asize; k++) {
+        PUTW(HDRP(bp), PACK(asize, prev_alloc, 1));
+        ptrs[k] = bp;
+        bp = (char *)bp + asize;
+        fsize -= asize;
+        prev_alloc = 1;
+    }
+    PUTW(HDRP(bp), PACK(fsize, prev_alloc, 0));
+    place(bp, asize);
+    ptrs[k] = bp;
+    return k + 1;
+}
+
+/*
+ * quick_fit - take the block at the head of the quick list of asize if it
+ * is large enough, any surplus is split off as with realloc.
+ */
+static void *quick_fit(size_t asize)
+{
+    char *root = QUICK_ROOT(asize >> QUICK_SHIFT);
+    char *bp = GET_NEXT(root);
+
+    if((bp == NULL) || (GET_SIZE(HDRP(bp)) < asize))
+        return NULL;
+
+    PUT_NEXT(root, GET_NEXT(bp));
+    quick_bytes -= QUICK_BYTES(asize >> QUICK_SHIFT);
+    realloc_place(bp, asize);
+    return bp;
+}
+
+/*
+ * quick_hold - hold the allocated block bp in quick list b, and flush the
+ * quick lists once they hold more than QUICK_LIMIT bytes
+ */
+static void quick_hold(void *bp, size_t b)
+{
+    PUT_NEXT(bp, GET_NEXT(QUICK_ROOT(b)));
+    PUT_NEXT(QUICK_ROOT(b), bp);
+    quick_bytes += QUICK_BYTES(b);
+    if(quick_bytes > QUICK_LIMIT)
+        quick_flush();
+}
+
+/*
+ * quick_flush - free and coalesce every block held in the quick lists
+ */
+static void quick_flush(void)
+{
+    char *bp;
+    size_t b;
+
+    quick_bytes = 0;  /* block_release must not flush again */
+    for(b = 0; b < QUICKN; b++) {
+        while((bp = GET_NEXT(QUICK_ROOT(b))) != NULL) {
+            PUT_NEXT(QUICK_ROOT(b), GET_NEXT(bp));
+            block_release(bp);
+        }
     }
 }
 
+/*
+ * grow_mark - remember bp as the block grown by the last upward realloc,
+ * asize is its block size without headroom. Blocks smaller than GROW_MIN
+ * are never given headroom and not tracked, so grow_bp is never a slab
+ * slot or a block held in a thread cache.
+ */
+static void *grow_mark(void *bp, size_t asize)
+{
+    if(asize >= GROW_MIN) {
+        grow_bp = bp;
+        grow_asize = asize;
+    }
+    return bp;
+}
+
 /* 
  * coalesce - merges adjacent free blocks using the boundary-tags coalescing technique
  */
 static void *coalesce(void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
     /* prev and next allocated */
     if(prev_alloc && next_alloc) {
-        PUTW(HDRP(bp), PACK(size, 0));
-        PUTW(FTRP(bp), PACK(size, 0));
         return bp;
     }
     /* prev allocated, next free */
     else if(prev_alloc && !next_alloc) {
         /* detach the next free block */
         detach_node(NEXT_BLKP(bp));
-        /* coalesce the prev free block */
+        /* coalesce the next free block */
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUTW(HDRP(bp), PACK(size, 0));
-        PUTW(FTRP(bp), PACK(size, 0));
+        PUTW(HDRP(bp), PACK(size, prev_alloc, 0));
+        PUTW(FTRP(bp), PACK(size, prev_alloc, 0));
     }
     /* prev free, next allocated */
     else if(!prev_alloc && next_alloc) {
         /* detach the prev free block */
         detach_node(PREV_BLKP(bp));
-        /* coalesce the next free block */
+        /* coalesce the prev free block */
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        prev_alloc = GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)));
         bp = PREV_BLKP(bp);
-        PUTW(HDRP(bp), PACK(size, 0));
-        PUTW(FTRP(bp), PACK(size, 0));
+        PUTW(HDRP(bp), PACK(size, prev_alloc, 0));
+        PUTW(FTRP(bp), PACK(size, prev_alloc, 0));
     }
     /* prev and next free */
     else if(!prev_alloc && !next_alloc) {
@@ -388,14 +1576,115 @@ static void *coalesce(void *bp)
         detach_node(PREV_BLKP(bp));
         /* coalesce the next and prev free blocks */
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
+        prev_alloc = GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)));
         bp = PREV_BLKP(bp);
-        PUTW(HDRP(bp), PACK(size, 0));
-        PUTW(FTRP(bp), PACK(size, 0));
+        PUTW(HDRP(bp), PACK(size, prev_alloc, 0));
+        PUTW(FTRP(bp), PACK(size, prev_alloc, 0));
     }
 
     return bp;
 }
 
+/*
+ * heap_trim - if a free block ends the heap, holds TRIM_THRESHOLD bytes
+ * more than pad and was freed decay operations ago, shrink the heap so
+ * that pad bytes and the chunk remainder are left of it
+ */
+static void heap_trim(size_t pad, unsigned int decay)
+{
+    char *bp, *end = (char *)mem_heap_hi() + 1;
+    size_t size, prev_alloc, release;
+    unsigned int epoch;
+
+    if(GET_PREV_ALLOC(HDRP(end)))
+        return;
+    bp = PREV_BLKP(end);
+    size = GET_SIZE(HDRP(bp));
+    epoch = GETW(EPOCHP(bp));
+    if((size < pad + TRIM_THRESHOLD) ||
+       ((epoch != PURGED) && (purge_clock - epoch < decay)))
+        return;
+
+    release = (size - pad) & ~(size_t)(CHUNKSIZE - 1);
+    detach_node(bp);
+    if(mem_sbrk(-(int)release) != (void *)-1) {
+        size -= release;
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        PUTW(HDRP(bp), PACK(size, prev_alloc, 0));
+        PUTW(FTRP(bp), PACK(size, prev_alloc, 0));
+        PUTW(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));   /* new epilogue header */
+    }
+    insert_list(bp);
+}
+
+/*
+ * purge_tick - advance the heap clock by one operation, every PURGE_SWEEP
+ * operations the end of the heap is trimmed and the purge queue is popped
+ * until its head was freed less than PURGE_DECAY operations ago. The pages
+ * wholly inside a popped node are purged, the links, the node size and the
+ * epoch in front of the pages and the footer stay intact.
+ */
+static void purge_tick(void)
+{
+    char *bp;
+
+    if((++purge_clock % PURGE_SWEEP) != 0)
+        return;
+    heap_trim(TRIM_PAD, PURGE_DECAY);
+    while(((bp = purge_head) != NULL) &&
+          (purge_clock - GETW(EPOCHP(bp)) >= PURGE_DECAY)) {
+        purge_dequeue(bp);
+        mem_purge(bp + 4*WSIZE, FTRP(bp));
+        PUTW(EPOCHP(bp), PURGED);
+    }
+}
+
+/*
+ * purge_enqueue - append the tree node bp to the purge queue, the epochs
+ * along the queue never decrease as every node is stamped when it is queued
+ */
+static void purge_enqueue(void *bp)
+{
+    PUT_QNEXT(bp, NULL);
+    PUT_QPREV(bp, purge_tail);
+    if(purge_tail != NULL)
+        PUT_QNEXT(purge_tail, bp);
+    else
+        purge_head = bp;
+    purge_tail = bp;
+}
+
+/*
+ * purge_dequeue - unlink the tree node bp from the purge queue
+ */
+static void purge_dequeue(void *bp)
+{
+    char *next_bp = GET_QNEXT(bp);
+    char *prev_bp = GET_QPREV(bp);
+
+    if(prev_bp != NULL)
+        PUT_QNEXT(prev_bp, next_bp);
+    else
+        purge_head = next_bp;
+    if(next_bp != NULL)
+        PUT_QPREV(next_bp, prev_bp);
+    else
+        purge_tail = prev_bp;
+}
+
+/*
+ * trim_flush - called once a free block of TRIM_FLUSH bytes forms, the
+ * blocks held in the quick lists and the empty slab pages are freed, so
+ * that they can join the free space around them and the end of the heap
+ * can be trimmed
+ */
+static void trim_flush(void)
+{
+    if(quick_bytes > 0)
+        quick_flush();
+    slab_trim();
+}
+
 /* 
  * insert bp to the segregated free list
  */
@@ -405,20 +1694,31 @@ static void insert_list(void *bp)
     char *prev_node = NULL;
     char *next_node = NULL;
     size_t n = 0;
-    size_t asize = GET_SIZE(HDRP(bp));
+    size_t size, asize = GET_SIZE(HDRP(bp));
+
+    PUTW(NODEP(bp), GETW(HDRP(bp)));  /* the size for list walks */
+
+    /* large blocks go to the tree */
+    if(asize >= TREE_SIZE) {
+        PUTW(EPOCHP(bp), purge_clock);
+        if(asize >= PURGE_MIN)
+            purge_enqueue(bp);
+        PUT_ROOT(tree_insert(TREE_ROOT(), bp));
+        return;
+    }
 
     /* calculate the size class n */
-    while(asize > 1 && n < MAXN) {
-        asize >>= 1;
+    for(size = asize; size > 1 && n < MAXN; size >>= 1)
         n++;
-    }
     size_class = freelist_root + (WSIZE*n);
+    if(asize > class_max[n])
+        class_max[n] = asize;
 
     /* bp should be put between prev and next node */
     prev_node = size_class;
     next_node = GET_NEXT(size_class);
     while(next_node != NULL) {
-        if(asize > GET_SIZE(HDRP(next_node))) {
+        if(asize > NODE_SIZE(next_node)) {
             prev_node = next_node;
             next_node = GET_NEXT(next_node);
         }
@@ -454,11 +1754,457 @@ static void detach_node(void *bp)
     char *next_bp = GET_NEXT(bp);
     char *prev_bp = GET_PREV(bp);
 
+    if(NODE_SIZE(bp) >= TREE_SIZE) {
+        if(QUEUED(bp))
+            purge_dequeue(bp);
+        PUT_ROOT(tree_remove(TREE_ROOT(), bp));
+        return;
+    }
+
     PUT_NEXT(GET_PREV(bp), next_bp);  /* update prev free block */
     if(next_bp != NULL)
         PUT_PREV(GET_NEXT(bp), prev_bp);  /* update next free block */
 }
 
+/*
+ * tree_fit - best-fit search in the tree, the smallest block >= asize
+ */
+static void *tree_fit(size_t asize)
+{
+    char *bp = TREE_ROOT();
+    char *fit = NULL;
+
+    while(bp != NULL) {
+        if(NODE_SIZE(bp) >= asize) {
+            fit = bp;  /* smaller fits can only be on the left */
+            bp = GET_LEFT(bp);
+        }
+        else {
+            bp = GET_RIGHT(bp);
+        }
+    }
+
+    return fit;
+}
+
+/*
+ * tree_insert - insert bp to the subtree root and return the new subtree root
+ * bp is inserted as a leaf and rotated up while its priority is higher
+ * than the priority of its parent.
+ */
+static void *tree_insert(void *root, void *bp)
+{
+    char *child;
+
+    if(root == NULL) {
+        PUT_LEFT(bp, NULL);
+        PUT_RIGHT(bp, NULL);
+        return bp;
+    }
+
+    if(TREE_LESS(bp, root)) {
+        child = tree_insert(GET_LEFT(root), bp);
+        if(PRIO(child) > PRIO(root)) {  /* rotate right */
+            PUT_LEFT(root, GET_RIGHT(child));
+            PUT_RIGHT(child, root);
+            return child;
+        }
+        PUT_LEFT(root, child);
+    }
+    else {
+        child = tree_insert(GET_RIGHT(root), bp);
+        if(PRIO(child) > PRIO(root)) {  /* rotate left */
+            PUT_RIGHT(root, GET_LEFT(child));
+            PUT_LEFT(child, root);
+            return child;
+        }
+        PUT_RIGHT(root, child);
+    }
+
+    return root;
+}
+
+/*
+ * tree_remove - remove bp from the subtree root and return the new subtree root
+ */
+static void *tree_remove(void *root, void *bp)
+{
+    if(root == bp)
+        return tree_merge(GET_LEFT(bp), GET_RIGHT(bp));
+
+    if(TREE_LESS(bp, root))
+        PUT_LEFT(root, tree_remove(GET_LEFT(root), bp));
+    else
+        PUT_RIGHT(root, tree_remove(GET_RIGHT(root), bp));
+
+    return root;
+}
+
+/*
+ * tree_merge - merge two subtrees, every key in left is less than in right
+ */
+static void *tree_merge(void *left, void *right)
+{
+    if(left == NULL)
+        return right;
+    if(right == NULL)
+        return left;
+
+    if(PRIO(left) > PRIO(right)) {
+        PUT_RIGHT(left, tree_merge(GET_RIGHT(left), right));
+        return left;
+    }
+    else {
+        PUT_LEFT(right, tree_merge(left, GET_LEFT(right)));
+        return right;
+    }
+}
+
+/*
+ * slab_alloc - take the first free slot of the first partial page of the
+ * slab class, a new page is allocated if the class has no partial page.
+ */
+static void *slab_alloc(size_t size)
+{
+    size_t c = SLAB_CLASS(size);
+    size_t slot = SLAB_SLOT(c);
+    size_t i = 0;
+    unsigned int map;
+    char *page;
+
+    if((page = slab_partial(c)) == NULL)
+        return NULL;
+
+    /* find the first free slot, a partial page has at least one */
+    while((map = GETW(SLAB_MAPP(page, i))) == 0)
+        i++;
+    PUTW(SLAB_MAPP(page, i), map & (map - 1));  /* clear the lowest bit */
+    PUTW(SLAB_NFREEP(page), GETW(SLAB_NFREEP(page)) - 1);
+
+    /* a full page leaves the partial list */
+    if(GETW(SLAB_NFREEP(page)) == 0)
+        slab_unlink(page);
+
+    return page + SLAB_OFFSET(slot) + (i*32 + __builtin_ctz(map))*slot;
+}
+
+/*
+ * slab_alloc_batch - take n slots of the slab class of size, every free
+ * slot of a page is taken before the next page is looked at.
+ */
+static size_t slab_alloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t c = SLAB_CLASS(size);
+    size_t slot = SLAB_SLOT(c);
+    size_t i, nfree, k = 0;
+    unsigned int map;
+    char *page;
+
+    while(k < n) {
+        if((page = slab_partial(c)) == NULL)
+            break;
+        nfree = GETW(SLAB_NFREEP(page));
+        for(i = 0; k < n && nfree > 0; i++) {
+            map = GETW(SLAB_MAPP(page, i));
+            for(; k < n && map != 0; map &= map - 1) {
+                ptrs[k++] = page + SLAB_OFFSET(slot) + (i*32 + __builtin_ctz(map))*slot;
+                nfree--;
+            }
+            PUTW(SLAB_MAPP(page, i), map);
+        }
+        PUTW(SLAB_NFREEP(page), nfree);
+        if(nfree == 0)
+            slab_unlink(page);
+    }
+    return k;
+}
+
+/*
+ * slab_partial - the first partial page of slab class c, a new page is
+ * allocated if the class has no partial page.
+ */
+static void *slab_partial(size_t c)
+{
+    char *page = GET_NEXT(SLAB_ROOT(c));
+
+    if(page == NULL) {
+        if((page = slab_page(SLAB_SLOT(c))) == NULL)
+            return NULL;
+        PUT_NEXT(page, NULL);  /* the only partial page of this class */
+        PUT_PREV(page, SLAB_ROOT(c));
+        PUT_NEXT(SLAB_ROOT(c), page);
+    }
+    return page;
+}
+
+/*
+ * slab_free - return the slot to its page. A page that becomes partial
+ * joins the partial list, a page that becomes empty is freed back to the
+ * heap unless it is the last partial page of its class.
+ */
+static void slab_free(void *bp)
+{
+    char *page = PAGEP(bp);
+    size_t slot = GETW(SLAB_SLOTP(page));
+    size_t c = SLAB_CLASS(slot);
+    size_t nfree = GETW(SLAB_NFREEP(page)) + 1;
+    size_t i = ((char *)bp - page - SLAB_OFFSET(slot)) / slot;
+    char *next_page;
+
+    PUTW(SLAB_MAPP(page, i / 32), GETW(SLAB_MAPP(page, i / 32)) | (1U << (i % 32)));
+    PUTW(SLAB_NFREEP(page), nfree);
+
+    if(nfree == 1) {  /* the page was full, push it to the partial list */
+        next_page = GET_NEXT(SLAB_ROOT(c));
+        PUT_NEXT(page, next_page);
+        PUT_PREV(page, SLAB_ROOT(c));
+        if(next_page != NULL)
+            PUT_PREV(next_page, page);
+        PUT_NEXT(SLAB_ROOT(c), page);
+    }
+
+    if(nfree == GETW(SLAB_NSLOTSP(page)) &&
+       (GET_PREV(page) != SLAB_ROOT(c) || GET_NEXT(page) != NULL))
+        slab_release(page);
+}
+
+/*
+ * slab_release - unlink the empty page and free it to the heap
+ */
+static void slab_release(void *page)
+{
+    slab_unlink(page);
+    PUTW(SLAB_MAGICP(page), 0);  /* no stale magic may be left behind */
+    PUTW(HDRP(page), GETW(HDRP(page)) & ~SLAB_BIT);
+    heap_free(page);
+}
+
+/*
+ * slab_trim - free the empty page every slab class keeps as its last
+ * partial page, so that it does not pin the end of the heap
+ */
+static void slab_trim(void)
+{
+    char *page;
+    size_t c;
+
+    for(c = 0; c < SLABN; c++) {
+        page = GET_NEXT(SLAB_ROOT(c));
+        if((page != NULL) && (GET_NEXT(page) == NULL) &&
+           (GETW(SLAB_NFREEP(page)) == GETW(SLAB_NSLOTSP(page))))
+            slab_release(page);
+    }
+}
+
+/*
+ * slab_unlink - detach the page from the partial list of its class
+ * (detach_node would take a page for a large free block)
+ */
+static void slab_unlink(void *page)
+{
+    char *next_page = GET_NEXT(page);
+
+    PUT_NEXT(GET_PREV(page), next_page);
+    if(next_page != NULL)
+        PUT_PREV(next_page, GET_PREV(page));
+}
+
+/*
+ * slab_page - allocate and initialize a slab page of slot size slot.
+ * The page is carved from a free block large enough to hold an aligned
+ * page, or from a new block at the end of the heap. The space in front of
+ * the page is left as a free block.
+ */
+static void *slab_page(size_t slot)
+{
+    char *bp, *page, *end;
+    size_t fsize, lead, trail, prev_alloc, nslots, i;
+
+    /* any free block of this size contains an aligned page */
+    if((bp = find_fit(SLAB_BLKSIZE + PAGESIZE + 2*DSIZE)) == NULL) {
+        /* grow the heap (and the free block at its end) up to a page */
+        end = (char *)mem_heap_hi() + 1;
+        bp = end;
+        if(!GET_PREV_ALLOC(HDRP(end)))
+            bp = PREV_BLKP(end);
+        page = PAGEP(bp + PAGESIZE - 1);
+        if(page != bp && page - bp < 2*DSIZE)
+            page += PAGESIZE;
+        /* the free block at the end may already hold the page */
+        if((page + SLAB_BLKSIZE > end) && extend_heap(page + SLAB_BLKSIZE - end) == NULL)
+            return NULL;
+    }
+    detach_node(bp);
+
+    /* the space in front of the page must be empty or a free block */
+    page = PAGEP(bp + PAGESIZE - 1);
+    if(page != bp && page - bp < 2*DSIZE)
+        page += PAGESIZE;
+    fsize = GET_SIZE(HDRP(bp));
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    lead = page - bp;
+    trail = fsize - lead - SLAB_BLKSIZE;
+
+    if(lead) {
+        PUTW(HDRP(bp), PACK(lead, prev_alloc, 0));
+        PUTW(FTRP(bp), PACK(lead, prev_alloc, 0));
+        insert_list(bp);
+        prev_alloc = 0;
+    }
+    if(trail < 2*DSIZE) {  /* too small for a free block */
+        PUTW(HDRP(page), PACK(SLAB_BLKSIZE + trail, prev_alloc, 1) | SLAB_BIT);
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(page)));
+    }
+    else {
+        PUTW(HDRP(page), PACK(SLAB_BLKSIZE, prev_alloc, 1) | SLAB_BIT);
+        bp = NEXT_BLKP(page);
+        PUTW(HDRP(bp), PACK(trail, 1, 0));
+        PUTW(FTRP(bp), PACK(trail, 1, 0));
+        insert_list(bp);
+    }
+
+    /* initialize the page header, every slot is free */
+    nslots = (PAGESIZE - SLAB_OFFSET(slot)) / slot;
+    PUTW(SLAB_MAGICP(page), SLAB_MAGIC_OF(page));
+    PUTW(SLAB_SLOTP(page), slot);
+    PUTW(SLAB_NFREEP(page), nslots);
+    PUTW(SLAB_NSLOTSP(page), nslots);
+    for(i = 0; i < SLAB_MAPN(slot); i++) {
+        if(nslots >= 32)
+            PUTW(SLAB_MAPP(page, i), ~0U);
+        else
+            PUTW(SLAB_MAPP(page, i), (1U << nslots) - 1);
+        nslots -= (nslots >= 32) ? 32 : nslots;
+    }
+
+    return page;
+}
+
+/*
+ * is_slab - return true if bp is a slot of a slab page.
+ * The payload of a regular block is never 4kB aligned inside a slab page,
+ * so bp is a slot iff the 4kB aligned address below bp starts a slab page.
+ */
+static int is_slab(void *bp)
+{
+    char *page = PAGEP(bp);
+
+    return (SLAB_MAX > 0) && (page > heap_listp) && (page != (char *)bp) &&
+           (GETW(HDRP(page)) & SLAB_BIT) && GET_ALLOC(HDRP(page)) &&
+           (GETW(SLAB_MAGICP(page)) == SLAB_MAGIC_OF(page));
+}
+
+/*
+ * huge_alloc - map a block of size bytes, its payload is aligned to a page
+ * or to alignment if that is larger. The mapping has room for the page (or
+ * alignment) in front of the payload, which holds its header and offset.
+ */
+static void *huge_alloc(size_t size, size_t alignment)
+{
+    char *map, *bp;
+    size_t len;
+
+    alignment = MAX(alignment, PAGESIZE);
+    len = alignment + ((size + PAGESIZE - 1) & ~(size_t)(PAGESIZE - 1));
+    if((map = mem_map(len)) == NULL)
+        return NULL;
+
+    bp = (char *)(((size_t)map + DSIZE + alignment - 1) & ~(alignment - 1));
+    PUTW(HUGE_OFFP(bp), bp - map);
+    PUTW(HDRP(bp), PACK(len, 1, 1) | HUGE_BIT);
+    return bp;
+}
+
+/*
+ * huge_free - unmap a huge block
+ */
+static void huge_free(void *bp)
+{
+    mem_unmap((char *)bp - GETW(HUGE_OFFP(bp)), GET_SIZE(HDRP(bp)));
+}
+
+/*
+ * huge_realloc - resize the mapping of a huge block in place or move it with
+ * mem_remap, the payload is not copied. A block shrunk below HUGE_MIN is
+ * copied back into the heap, up to the end of its mapping as a small
+ * memaligned block may grow.
+ */
+static void *huge_realloc(void *bp, size_t size)
+{
+    size_t off = GETW(HUGE_OFFP(bp)), len = GET_SIZE(HDRP(bp)), new_len;
+    char *map = (char *)bp - off, *new_bp;
+
+    if(size < HUGE_MIN) {
+        if((new_bp = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(new_bp, bp, MIN(size, len - off));
+        huge_free(bp);
+        return new_bp;
+    }
+
+    new_len = off + ((size + PAGESIZE - 1) & ~(size_t)(PAGESIZE - 1));
+    if(new_len == len)
+        return bp;
+    if((map = mem_remap(map, len, new_len)) == NULL)
+        return NULL;
+    bp = map + off;
+    PUTW(HDRP(bp), PACK(new_len, 1, 1) | HUGE_BIT);
+    return bp;
+}
+
+#ifdef THREAD_SAFE
+/*
+ * tcache_get - return the cache of the calling thread, a cache left over
+ * from before the last mm_init is dropped without touching the new heap.
+ */
+static tcache_t *tcache_get(void)
+{
+    tcache_t *tc = &tcache;
+
+    if(tc->gen != heap_gen) {
+        memset(tc, 0, sizeof(tcache_t));
+        tc->gen = heap_gen;
+        pthread_setspecific(tcache_key, tc);
+    }
+    return tc;
+}
+
+/*
+ * tcache_flush - give n blocks of bin b back to the heap under one lock
+ */
+static void tcache_flush(tcache_t *tc, size_t b, size_t n)
+{
+    char *bp;
+
+    pthread_mutex_lock(&heap_lock);
+    while(n-- > 0 && (bp = tc->bins[b]) != NULL) {
+        tc->bins[b] = GET_NEXT(bp);
+        tc->count[b]--;
+        heap_free(bp);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * tcache_exit - flush every bin of an exiting thread
+ */
+static void tcache_exit(void *arg)
+{
+    tcache_t *tc = arg;
+    size_t b;
+
+    if(tc->gen != heap_gen)
+        return;
+    for(b = 0; b < CACHEN; b++)
+        tcache_flush(tc, b, tc->count[b]);
+}
+
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+#endif
+
 /* 
  * check the consistency of heap
  */
@@ -478,6 +2224,8 @@ static void checkheap(int verbose)
         if(verbose)
             printblock(bp);
         checkblock(bp);
+        if(GETW(HDRP(bp)) & SLAB_BIT)
+            checkslab(bp);
     }
 
     /* check epilogue block */
@@ -498,27 +2246,55 @@ static void checkblock(void *bp)
         printblock(bp);
     }
 
-    if(GETW(HDRP(bp)) != GETW(FTRP(bp))) {
+    if(!GET_ALLOC(HDRP(bp)) && (GETW(HDRP(bp)) != GETW(FTRP(bp)))) {
         printf("Error: header does not match footer\n");
         printblock(bp);
     }
+    if(GET_ALLOC(HDRP(bp)) != GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+        printf("Error: prev_alloc bit of the next block is wrong\n");
+        printblock(bp);
+    }
     if(!GET_ALLOC(HDRP(bp))) {
-        if(!GET_ALLOC(HDRP(PREV_BLKP(bp))) || !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+        if(!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
             printf("Error: contiguous free block\n");
     }
 }
 
+/* 
+ * check the slab page header and its free slot bitmap
+ */
+static void checkslab(void *page)
+{
+    size_t slot = GETW(SLAB_SLOTP(page));
+    size_t nfree = 0;
+    size_t i;
+
+    if((size_t)page % PAGESIZE)
+        printf("Error: slab page is not page aligned\n");
+    if(!GET_ALLOC(HDRP(page)) || GETW(SLAB_MAGICP(page)) != SLAB_MAGIC_OF(page))
+        printf("Error: bad slab page header\n");
+    if(slot == 0 || slot > SLAB_MAX || SLAB_SLOT(SLAB_CLASS(slot)) != slot) {
+        printf("Error: bad slab slot size\n");
+        return;
+    }
+    for(i = 0; i < SLAB_MAPN(slot); i++)
+        nfree += __builtin_popcount(GETW(SLAB_MAPP(page, i)));
+    if(nfree != GETW(SLAB_NFREEP(page)) || nfree > GETW(SLAB_NSLOTSP(page)))
+        printf("Error: slab free slot count does not match the bitmap\n");
+}
+
 /* 
  * check the segregated free list
  */
 static void checklist(int verbose)
 {
-    char *bp;
+    char *bp, *prev;
     char *size_class;
+    size_t held;
     int n = 1;
 
     /* check the segregated free list */
-    for(n = 1; n <= MAXN; n++) {
+    for(n = 1; n < MAXN; n++) {
         size_class = (freelist_root + (n*WSIZE));
         if(verbose) 
             printf("Size class: %d ~ %d\n", (1<<n), ((1<<(n + 1)) - 1));
@@ -535,8 +2311,76 @@ static void checklist(int verbose)
             /* check if any allocated block still in the free list */
             if(GET_ALLOC(HDRP(bp)) || GET_ALLOC(FTRP(bp)))
                 printf("Error: allocated block exist in the free list");
+            if(NODE_SIZE(bp) != GET_SIZE(HDRP(bp)))
+                printf("Error: wrong node size");
+            if(NODE_SIZE(bp) > class_max[n])
+                printf("Error: block above the bound of its size class\n");
         }
     }
+
+    /* check the tree of large blocks */
+    if(verbose) 
+        printf("Size class: %d ~\n", TREE_SIZE);
+    checktree(TREE_ROOT(), NULL, NULL, verbose);
+
+    /* check the purge queue, the node freed first at the head */
+    prev = NULL;
+    for(bp = purge_head; bp != NULL; prev = bp, bp = GET_QNEXT(bp)) {
+        if(GET_ALLOC(HDRP(bp)) || !QUEUED(bp))
+            printf("Error: wrong node in the purge queue\n");
+        if(GET_QPREV(bp) != prev)
+            printf("Error: the purge queue is broken\n");
+        if((prev != NULL) && (purge_clock - GETW(EPOCHP(bp)) >
+                              purge_clock - GETW(EPOCHP(prev))))
+            printf("Error: wrong order in the purge queue\n");
+    }
+    if(prev != purge_tail)
+        printf("Error: wrong tail of the purge queue\n");
+
+    /* check the quick lists, held blocks stay marked allocated */
+    held = 0;
+    for(n = 0; n < QUICKN; n++) {
+        for(bp = GET_NEXT(QUICK_ROOT(n)); bp != NULL; bp = GET_NEXT(bp)) {
+            if(!GET_ALLOC(HDRP(bp)))
+                printf("Error: free block exist in a quick list\n");
+            if((GET_SIZE(HDRP(bp)) >> QUICK_SHIFT) < (size_t)n)
+                printf("Error: block in the wrong quick list\n");
+            held += QUICK_BYTES(n);
+        }
+    }
+    if(held != quick_bytes)
+        printf("Error: quick lists hold %zu bytes, not %zu\n", held, quick_bytes);
+}
+
+/* 
+ * check the tree order and heap priority of the subtree root, every key
+ * must lie between lo and hi (NULL for no bound).
+ * return the number of nodes in the subtree
+ */
+static int checktree(void *root, void *lo, void *hi, int verbose)
+{
+    char *left, *right;
+
+    if(root == NULL)
+        return 0;
+
+    left = GET_LEFT(root);
+    right = GET_RIGHT(root);
+    if(verbose) 
+        printf("%p: size: [%zu] left: [%p] right: [%p]\n", root, 
+               (size_t)GET_SIZE(HDRP(root)), left, right);
+    if(GET_SIZE(HDRP(root)) < TREE_SIZE)
+        printf("Error: small block exist in the tree\n");
+    if((lo != NULL && !TREE_LESS(lo, root)) || (hi != NULL && !TREE_LESS(root, hi)))
+        printf("Error: wrong tree order\n");
+    if((left != NULL && PRIO(left) > PRIO(root)) || (right != NULL && PRIO(right) > PRIO(root)))
+        printf("Error: wrong tree priority\n");
+    if(GET_ALLOC(HDRP(root)) || GET_ALLOC(FTRP(root)))
+        printf("Error: allocated block exist in the tree\n");
+    if(NODE_SIZE(root) != GET_SIZE(HDRP(root)))
+        printf("Error: wrong node size\n");
+
+    return 1 + checktree(left, lo, root, verbose) + checktree(right, root, hi, verbose);
 }
 
 /* 
@@ -546,11 +2390,18 @@ static void printblock(void *bp)
 {
     size_t header_size = GET_SIZE(HDRP(bp));
     size_t header_alloc = GET_ALLOC(HDRP(bp));
-    size_t footer_size = GET_SIZE(FTRP(bp));
-    size_t footer_alloc = GET_ALLOC(FTRP(bp));
-        
-    printf("%p: header: [%zu/%c] footer: [%zu/%c]\n", bp, 
-           header_size, (header_alloc ? 'a' : 'f'), 
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t footer_size, footer_alloc;
+
+    if(header_alloc) {  /* allocated blocks have no footer */
+        printf("%p: header: [%zu/%c/%c]\n", bp, 
+               header_size, (prev_alloc ? 'a' : 'f'), 'a');
+        return;
+    }
+    footer_size = GET_SIZE(FTRP(bp));
+    footer_alloc = GET_ALLOC(FTRP(bp));
+    printf("%p: header: [%zu/%c/%c] footer: [%zu/%c]\n", bp, 
+           header_size, (prev_alloc ? 'a' : 'f'), 'f', 
            footer_size, (footer_alloc ? 'a' : 'f')); 
 }
 
@@ -3,7 +3,23 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern size_t mm_malloc_batch(size_t size, void **ptrs, size_t n);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* arenas: bump allocation freed all at once, see mm_arena.c */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(size_t chunk_size);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void *mm_arena_mark(mm_arena_t *arena);
+extern void mm_arena_release(mm_arena_t *arena, void *mark);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
 
 
 /* 
@@ -0,0 +1,169 @@
+/*
+ * mm_arena.c - region allocation on top of the mm malloc package.
+ *
+ * An arena hands out memory by bumping a pointer through chunks that it
+ * takes from mm_malloc, and gives it back all at once instead of block by
+ * block: mm_arena_reset frees every chunk but the first with mm_free, so
+ * the chunks return to the free lists of the allocator. The cost is one
+ * mm_free per chunk, O(chunks), and does not depend on the number of
+ * blocks allocated. mm_arena_release does the same back to a mark taken
+ * with mm_arena_mark.
+ *
+ * chunk: a header with the chunk below and the end of the chunk, followed
+ *        by the bump area. The chunks form a stack, the bump pointer moves
+ *        through the top chunk. A request that does not fit in the rest of
+ *        the top chunk pushes a new chunk of the arena chunk size, or of
+ *        the request size if larger (the rest of the old top is not used).
+ *
+ * Blocks of an arena cannot be freed or reallocated one by one. The arena
+ * record and its chunks live in the heap, so an arena does not survive
+ * mm_init. An arena is not thread-safe, every thread should use its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+
+/* default chunk size (bytes) */
+#define ARENA_CHUNK (1<<14)
+
+#define MAX(x, y) ((x) > (y)? (x):(y))
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+
+/* chunk header, the bump area starts at the next aligned address */
+typedef struct chunk {
+    struct chunk *prev;  /* the chunk below on the stack, NULL if none */
+    char *end;           /* first byte behind the chunk */
+} chunk_t;
+
+#define CHUNK_HDR       ALIGN(sizeof(chunk_t))
+#define CHUNK_START(c)  ((char *)(c) + CHUNK_HDR)
+
+/* true if the mark ptr lies in the bump area of chunk c */
+#define IN_CHUNK(c, ptr) (((char *)(ptr) >= CHUNK_START(c)) && \
+                          ((char *)(ptr) <= (c)->end))
+
+struct mm_arena {
+    chunk_t *top;        /* top chunk, NULL if the arena has no chunk */
+    char *cur;           /* bump pointer in the top chunk */
+    size_t chunk_size;   /* size of a new chunk (bytes) */
+};
+
+static void *arena_grow(mm_arena_t *arena, size_t size);
+static void arena_pop(mm_arena_t *arena);
+
+/*
+ * mm_arena_create - create an empty arena whose chunks are chunk_size
+ * bytes (ARENA_CHUNK if 0). return NULL if out of memory
+ */
+mm_arena_t *mm_arena_create(size_t chunk_size)
+{
+    mm_arena_t *arena;
+
+    if((arena = mm_malloc(sizeof(mm_arena_t))) == NULL)
+        return NULL;
+    arena->top = NULL;
+    arena->cur = NULL;
+    arena->chunk_size = chunk_size ? ALIGN(chunk_size) : ARENA_CHUNK;
+    return arena;
+}
+
+/*
+ * mm_arena_alloc - allocate size bytes in the arena, 8-byte aligned.
+ * return NULL if size is 0 or if out of memory
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
+{
+    char *bp;
+
+    if(size == 0)
+        return NULL;
+    size = ALIGN(size);
+
+    if((arena->top == NULL) || (size > (size_t)(arena->top->end - arena->cur)))
+        return arena_grow(arena, size);
+    bp = arena->cur;
+    arena->cur += size;
+    return (void *)bp;
+}
+
+/*
+ * mm_arena_mark - the current position of the arena, for a later
+ * mm_arena_release. NULL marks an arena without chunks.
+ */
+void *mm_arena_mark(mm_arena_t *arena)
+{
+    return (void *)arena->cur;
+}
+
+/*
+ * mm_arena_release - free every block allocated since mark was taken, the
+ * chunks pushed since then are given back with mm_free.
+ */
+void mm_arena_release(mm_arena_t *arena, void *mark)
+{
+    while((arena->top != NULL) && ((mark == NULL) || !IN_CHUNK(arena->top, mark)))
+        arena_pop(arena);
+    arena->cur = mark;
+}
+
+/*
+ * mm_arena_reset - free every block of the arena in O(chunks), all chunks
+ * but the first are given back with mm_free and the first one is kept for
+ * reuse.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    if(arena->top == NULL)
+        return;
+    while(arena->top->prev != NULL)
+        arena_pop(arena);
+    arena->cur = CHUNK_START(arena->top);
+}
+
+/*
+ * mm_arena_destroy - free every chunk and the arena itself
+ */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    mm_arena_release(arena, NULL);
+    mm_free(arena);
+}
+
+/*
+ * arena_grow - push a new chunk for a request of size (aligned) bytes and
+ * allocate the request at its start. The chunk ends where its usable size
+ * does.
+ */
+static void *arena_grow(mm_arena_t *arena, size_t size)
+{
+    chunk_t *c;
+
+    if(size > (size_t)-1 - CHUNK_HDR)
+        return NULL;
+    if((c = mm_malloc(MAX(arena->chunk_size, CHUNK_HDR + size))) == NULL)
+        return NULL;
+
+    c->prev = arena->top;
+    c->end = (char *)c + mm_usable_size(c);
+    arena->top = c;
+    arena->cur = CHUNK_START(c) + size;
+    return (void *)CHUNK_START(c);
+}
+
+/*
+ * arena_pop - give the top chunk back with mm_free
+ */
+static void arena_pop(mm_arena_t *arena)
+{
+    chunk_t *c = arena->top;
+
+    arena->top = c->prev;
+    mm_free(c);
+}
@@ -0,0 +1,655 @@
+/* mm_buddy.c - a binary buddy allocator: every block is a power of two
+ * bytes, split in halves to serve a request and merged with its buddy
+ * when both halves are free.
+ *
+ * Note: this allocator uses a model of the memory system
+ * provided by the memlib.c package (max heap size: 20MB by default,
+ * see mem_init_size).
+ *
+ * Allocator: binary buddy system.
+ * Note: This allocator is compiled with option -m32 by default, which sets
+ * long and pointer types to 32 bits. It also builds as native 64-bit code
+ * (make M32=), since the free list links are 32-bit heap offsets.
+ *
+ * heap block: a block of order k holds 2^k bytes and starts at an arena
+ *             offset that is a multiple of 2^k, so the offset of its buddy
+ *             is its own offset with bit k flipped. One header word in
+ *             front of the payload holds the block size and the allocated
+ *             bit, there are no footers. The arena starts 4 bytes past an
+ *             8-byte boundary, so every payload is 8-byte aligned.
+ *
+ * free list: one list per order, and one bit per non-empty list in a
+ *            bitmap, so a fit is found with one bit scan and split down
+ *            in at most log n steps, and a free merges with its buddies in
+ *            at most log n steps without walking a list.
+ *
+ * heap growth: the arena grows at its end by one block of the missing
+ *              order once the end is aligned to it, and by the largest
+ *              block that keeps the end aligned until then.
+ *
+ * memalign: the payload is placed at the first aligned address in a block
+ *           large enough, and the word in front of it holds its offset in
+ *           the block (with OFFSET_BIT set) instead of a header.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/*********************************************************
+ * NOTE TO STUDENTS: Before you do anything else, please
+ * provide your team information in the following struct.
+ ********************************************************/
+team_t team = {
+    /* Team name */
+    "ateam",
+    /* First member's full name */
+    "Harry Bovik",
+    /* First member's email address */
+    "bovik@cs.cmu.edu",
+    /* Second member's full name (leave blank if none) */
+    "",
+    /* Second member's email address (leave blank if none) */
+    ""
+};
+
+/* private global variables */
+static char *buddy_root;  /* start ptr for the bitmap and the list heads */
+static char *arena;       /* offset 0 of the buddy blocks */
+static char *heap_base;   /* mem_heap_lo(), base of the free list links */
+
+/* private functions */
+static void *extend_heap(size_t order);
+static void *find_fit(size_t order);
+static void *split(void *bp, size_t order);
+static void *coalesce(void *bp);
+static size_t block_order(size_t asize);
+static void *block_of(void *ptr);
+static void insert_list(void *bp);
+static void detach_node(void *bp);
+
+/* heap checker */
+void mm_checkheap(int verbose);
+void mm_checklist(int verbose);
+static void checkheap(int verbose);
+static void checkblock(void *bp);
+static void printblock(void *bp);
+static void checklist(int verbose);
+static void printlist(void *bp);
+
+/* basic constants and macros */
+#define WSIZE 4             /* word size (bytes) */
+#define DSIZE 8             /* double word size (bytes) */
+#define MIN_ORDER 4         /* min block: header + 2 links, 16 bytes */
+#define MAX_ORDER 31        /* block sizes must fit in a word */
+#define MAX_REQUEST (1<<30) /* larger requests fail, sizes must fit in an int */
+
+#define MAX(x, y) ((x) > (y)? (x):(y))
+#define MIN(x, y) ((x) < (y)? (x):(y))
+
+/* pack a size and allocated bit into a word */
+#define PACK(size, alloc) ((size)|(alloc))
+
+/* read and write a word at address p */
+#define GETW(p)       (*(unsigned int *)(p))
+#define PUTW(p, val)  (*(unsigned int *)(p) = (unsigned int)(val))
+
+/* read the size and allocated fields from address p */
+#define GET_SIZE(p)   (GETW(p) & ~0x7)
+#define GET_ALLOC(p)  (GETW(p) & 0x1)
+
+/* the word in front of an aligned payload holds its offset in the block */
+#define OFFSET_BIT    0x2
+#define IS_OFFSET(p)  (GETW(p) & OFFSET_BIT)
+
+/* given block ptr bp, compute address of its header */
+#define HDRP(bp)      ((char *)(bp) - WSIZE)
+
+/* arena offset of block bp, and its buddy of the same size */
+#define BLK_OFF(bp)          ((size_t)((char *)(bp) - WSIZE - arena))
+#define BUDDYP(bp, size)     (arena + (BLK_OFF(bp) ^ (size)) + WSIZE)
+
+/* arena offset of the end of the heap */
+#define ARENA_END()          ((size_t)((char *)mem_heap_hi() + 1 - arena))
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+
+
+#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+
+/* free list links are 32-bit offsets from the first heap byte, so that two
+ * links fit in the 12 bytes behind the header of a min block with 64-bit
+ * pointers too. Offset 0 (the bitmap) stands for NULL. */
+#define GET_LINK(p)        link_ptr(GETW(p))
+#define PUT_LINK(p, ptr)   PUTW((p), link_off(ptr))
+
+/* double-linked free list manipulations */
+#define GET_NEXT(bp)       GET_LINK(bp)
+#define PUT_NEXT(bp, ptr)  PUT_LINK((bp), (ptr))
+#define GET_PREV(bp)       GET_LINK((char *)(bp) + WSIZE)
+#define PUT_PREV(bp, ptr)  PUT_LINK((char *)(bp) + WSIZE, (ptr))
+
+/* index of the least significant set bit (x != 0) */
+#define FFS(x)        (__builtin_ctz(x))
+
+/* address of the bitmap and the list heads (relative to buddy_root) */
+#define MAPP                 (buddy_root)
+#define HEADP(k)             (buddy_root + WSIZE*(1 + (k)))
+
+/* words in front of the arena (must be odd so that payloads are aligned) */
+#define ROOT_WORDS           (1 + MAX_ORDER + 1)
+
+/* convert between a free list link offset and a block ptr */
+static inline void *link_ptr(unsigned int off)
+{
+    return off ? (void *)(heap_base + off) : NULL;
+}
+
+static inline unsigned int link_off(void *ptr)
+{
+    return ptr ? (unsigned int)((char *)ptr - heap_base) : 0;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ * return 0 on success, -1 on error
+ */
+int mm_init(void)
+{
+    int i;
+
+    /* create the initial empty heap, the arena is empty as well */
+    heap_base = mem_heap_lo();
+    if((buddy_root = mem_sbrk(ROOT_WORDS*WSIZE)) == (void *)-1)
+        return -1;
+    /* clear the bitmap and every list head */
+    for(i = 0; i < ROOT_WORDS; i++)
+        PUTW(buddy_root + (WSIZE*i), 0);
+    arena = buddy_root + (WSIZE*ROOT_WORDS);
+
+    return 0;
+}
+
+/*
+ * mm_malloc - allocate the smallest block of a power of two bytes that
+ * holds the header and size bytes.
+ */
+void *mm_malloc(size_t size)
+{
+    size_t order;
+    char *bp;
+
+    /* ignore spurious requests */
+    if((size == 0) || (size > MAX_REQUEST))
+        return NULL;
+
+    order = block_order(size + WSIZE);
+    if(((bp = find_fit(order)) == NULL) && ((bp = extend_heap(order)) == NULL))
+        return NULL;
+
+    detach_node(bp);
+    bp = split(bp, order);
+    PUTW(HDRP(bp), PACK(1U << order, 1));
+    return (void *)bp;
+}
+
+/*
+ * mm_free - free the block and merge it with its free buddies.
+ */
+void mm_free(void *ptr)
+{
+    char *bp = block_of(ptr);
+
+    PUTW(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), 0));
+    insert_list(coalesce(bp));
+}
+
+/*
+ * mm_realloc - shrink the block by giving back its upper halves, or grow it
+ * in place by merging it with free upper buddies, otherwise allocate a new
+ * block and free the old one.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    char *bp, *buddy, *new_bp;
+    size_t size_now, order, end;
+
+    /* if ptr is NULL, the call is equivalent to mm malloc(size) */
+    if(ptr == NULL)
+        return mm_malloc(size);
+    /* if size is equal to zero, the call is equivalent to mm free(ptr) */
+    if(size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    if(size > MAX_REQUEST)
+        return NULL;
+
+    order = block_order(size + WSIZE);
+    bp = ptr;
+    if(!IS_OFFSET(HDRP(bp))) {
+        size_now = GET_SIZE(HDRP(bp));
+
+        /* shrink (or keep) the block in place */
+        if((1U << order) <= size_now)
+            return split(bp, order);
+
+        /* grow into the upper buddies if they are all whole and free */
+        end = ARENA_END();
+        for(; size_now < (1U << order); size_now <<= 1) {
+            buddy = BUDDYP(bp, size_now);
+            if((BLK_OFF(bp) & size_now) || (BLK_OFF(buddy) + size_now > end) ||
+               GET_ALLOC(HDRP(buddy)) || (GET_SIZE(HDRP(buddy)) != size_now))
+                break;
+        }
+        if(size_now >= (1U << order)) {
+            for(size_now = GET_SIZE(HDRP(bp)); size_now < (1U << order); size_now <<= 1)
+                detach_node(BUDDYP(bp, size_now));
+            PUTW(HDRP(bp), PACK(size_now, 1));
+            return ptr;
+        }
+    }
+
+    /* realloc a new block */
+    if((new_bp = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(new_bp, ptr, MIN(size, mm_usable_size(ptr)));
+    mm_free(ptr);
+    return (void *)new_bp;
+}
+
+/*
+ * mm_calloc - allocate a zeroed array of nmemb elements of size bytes.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    char *bp;
+
+    /* the array size must not overflow */
+    if((nmemb != 0) && (size > (size_t)-1 / nmemb))
+        return NULL;
+    size *= nmemb;
+
+    if((bp = mm_malloc(size)) != NULL)
+        memset(bp, 0, size);
+    return (void *)bp;
+}
+
+/*
+ * mm_memalign - allocate a block whose payload address is a multiple of
+ * alignment (a power of two). The block has room for the alignment, the
+ * word in front of an aligned payload that is not the block payload holds
+ * the offset to the block payload.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    char *bp, *p;
+
+    if((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if(alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if((size == 0) || (size > MAX_REQUEST) || (alignment > MAX_REQUEST))
+        return NULL;
+
+    if((bp = mm_malloc(size + alignment)) == NULL)
+        return NULL;
+
+    p = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+    if(p != bp)
+        PUTW(HDRP(p), PACK(p - bp, OFFSET_BIT));
+    return (void *)p;
+}
+
+/*
+ * mm_posix_memalign - mm_memalign with the posix_memalign interface.
+ * return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    /* alignment must be a power of two multiple of sizeof(void *) */
+    if((alignment == 0) || (alignment & (alignment - 1)) || (alignment % sizeof(void *)))
+        return EINVAL;
+    if(((bp = mm_memalign(alignment, size)) == NULL) && (size != 0))
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_usable_size - the number of bytes that can be used in the block ptr
+ */
+size_t mm_usable_size(void *ptr)
+{
+    char *bp;
+
+    if(ptr == NULL)
+        return 0;
+    bp = block_of(ptr);
+    return GET_SIZE(HDRP(bp)) - WSIZE - ((char *)ptr - bp);
+}
+
+/*
+ * mm_malloc_batch - allocate n blocks of at least size bytes each into
+ * ptrs, return the number of blocks allocated (less than n if out of memory).
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if((ptrs[k] = mm_malloc(size)) == NULL)
+            break;
+    }
+    return k;
+}
+
+/*
+ * mm_free_batch - free the n blocks in ptrs, NULL entries are skipped.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if(ptrs[k] != NULL)
+            mm_free(ptrs[k]);
+    }
+}
+
+/*
+ * mm_free_sized - same as mm_free, the size is not used.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    mm_free(ptr);
+}
+
+/*
+ * mm_checkheap - Check the heap for correctness
+ * This function is meant to be called through gdb
+ */
+void mm_checkheap(int verbose)
+{
+    checkheap(verbose);
+}
+
+/*
+ * mm_checklist- Check the free list for correctness
+ * This function is meant to be called through gdb
+ */
+void mm_checklist(int verbose)
+{
+    checklist(verbose);
+}
+
+/*
+ * internal helper functions
+ */
+
+/*
+ * extend_heap - grow the arena until a free block of at least the given
+ * order is in the free lists, and return it. A block of that order is
+ * added once the end of the arena is aligned to its size, before that the
+ * largest block that the end is aligned to is added and merged with its
+ * free buddies.
+ */
+static void *extend_heap(size_t order)
+{
+    char *bp;
+    size_t end, k;
+
+    for(;;) {
+        end = ARENA_END();
+        k = (end == 0) ? order : MIN((size_t)FFS(end), order);
+        /* a size beyond INT_MAX would reach mem_sbrk as a shrink */
+        if(((1UL << k) > INT_MAX) || ((bp = mem_sbrk(1 << k)) == (void *)-1))
+            return NULL;
+
+        bp += WSIZE;
+        PUTW(HDRP(bp), PACK(1U << k, 0));
+        bp = coalesce(bp);
+        insert_list(bp);
+        if(GET_SIZE(HDRP(bp)) >= (1U << order))
+            return bp;
+    }
+}
+
+/*
+ * find_fit - the first block of the smallest non-empty order that is not
+ * less than order, found with one bit scan
+ */
+static void *find_fit(size_t order)
+{
+    unsigned int map = GETW(MAPP) & (~0U << order);
+
+    if(!map)
+        return NULL;
+    return GET_NEXT(HEADP(FFS(map)));
+}
+
+/*
+ * split - halve the detached block bp until it is of the given order, the
+ * upper halves are freed. Return bp.
+ */
+static void *split(void *bp, size_t order)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *upper;
+
+    while(size > (1U << order)) {
+        size >>= 1;
+        upper = (char *)bp + size;
+        PUTW(HDRP(upper), PACK(size, 0));
+        insert_list(upper);
+    }
+    PUTW(HDRP(bp), PACK(size, GET_ALLOC(HDRP(bp))));
+    return bp;
+}
+
+/*
+ * coalesce - merge the free block bp with its buddy as long as the buddy is
+ * whole (of the same size) and free, the buddies are detached from the free
+ * lists. Return the merged block, which is not in a free list.
+ */
+static void *coalesce(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t end = ARENA_END();
+    char *buddy;
+
+    while(size < (1U << MAX_ORDER)) {
+        buddy = BUDDYP(bp, size);
+        if((BLK_OFF(buddy) + size > end) || GET_ALLOC(HDRP(buddy)) ||
+           (GET_SIZE(HDRP(buddy)) != size))
+            break;
+        detach_node(buddy);
+        bp = MIN((char *)bp, buddy);
+        size <<= 1;
+        PUTW(HDRP(bp), PACK(size, 0));
+    }
+    return bp;
+}
+
+/*
+ * block_order - the order of the smallest block of at least asize bytes
+ */
+static size_t block_order(size_t asize)
+{
+    size_t order = MIN_ORDER;
+
+    while((1UL << order) < asize)
+        order++;
+    return order;
+}
+
+/*
+ * block_of - the block of a payload returned by mm_malloc or mm_memalign
+ */
+static void *block_of(void *ptr)
+{
+    if(IS_OFFSET(HDRP(ptr)))
+        return (char *)ptr - GET_SIZE(HDRP(ptr));
+    return ptr;
+}
+
+/*
+ * insert bp to the root of its order and mark the order as non-empty
+ */
+static void insert_list(void *bp)
+{
+    size_t order = FFS(GET_SIZE(HDRP(bp)));
+    char *head = HEADP(order);
+    char *next_node = GET_NEXT(head);
+
+    PUT_NEXT(head, bp);
+    PUT_PREV(bp, head);
+    PUT_NEXT(bp, next_node);
+    if(next_node != NULL)
+        PUT_PREV(next_node, bp);
+
+    PUTW(MAPP, GETW(MAPP) | (1U << order));
+}
+
+/*
+ * detach bp from its order and clear the bitmap if the order is empty
+ *
+ * Note: need to re-insert bp back to the list after manipulation finished.
+ */
+static void detach_node(void *bp)
+{
+    char *next_bp = GET_NEXT(bp);
+    char *prev_bp = GET_PREV(bp);
+    size_t order = FFS(GET_SIZE(HDRP(bp)));
+
+    PUT_NEXT(prev_bp, next_bp);  /* update prev free block (or list head) */
+    if(next_bp != NULL)
+        PUT_PREV(next_bp, prev_bp);  /* update next free block */
+
+    if(GET_NEXT(HEADP(order)) == NULL)
+        PUTW(MAPP, GETW(MAPP) & ~(1U << order));
+}
+
+/*
+ * check the consistency of heap
+ */
+static void checkheap(int verbose)
+{
+    char *bp;
+    char *end = (char *)mem_heap_hi() + 1;
+
+    if(arena != heap_base + (WSIZE*ROOT_WORDS))
+        printf("Error: bad arena start\n");
+
+    /* check heap */
+    for(bp = arena + WSIZE; bp - WSIZE < end; bp += GET_SIZE(HDRP(bp))) {
+        if(verbose)
+            printblock(bp);
+        checkblock(bp);
+        if(GET_SIZE(HDRP(bp)) == 0)
+            break;
+    }
+
+    if(bp - WSIZE != end)
+        printf("Error: the last block does not end the heap\n");
+}
+
+/*
+ * check the heap content
+ */
+static void checkblock(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *buddy;
+
+    if((size_t)bp % 8) {
+        printf("Error: bp is not doubleword aligned\n");
+        printblock(bp);
+    }
+    if((size < (1U << MIN_ORDER)) || (size & (size - 1)) || IS_OFFSET(HDRP(bp))) {
+        printf("Error: bad block size\n");
+        printblock(bp);
+        return;
+    }
+    if(BLK_OFF(bp) & (size - 1)) {
+        printf("Error: block is not aligned to its size\n");
+        printblock(bp);
+    }
+    if(!GET_ALLOC(HDRP(bp))) {
+        buddy = BUDDYP(bp, size);
+        if((BLK_OFF(buddy) + size <= ARENA_END()) && !GET_ALLOC(HDRP(buddy)) &&
+           (GET_SIZE(HDRP(buddy)) == size))
+            printf("Error: free buddies not merged\n");
+    }
+}
+
+/*
+ * check the free list of every order and the bitmap
+ */
+static void checklist(int verbose)
+{
+    char *bp;
+    size_t order;
+    int empty;
+
+    for(order = 0; order <= MAX_ORDER; order++) {
+        empty = (GET_NEXT(HEADP(order)) == NULL);
+        if(empty != !(GETW(MAPP) & (1U << order)))
+            printf("Error: bitmap mismatch at order %zu\n", order);
+        if(verbose && !empty)
+            printf("Order: %zu\n", order);
+        for(bp = GET_NEXT(HEADP(order)); bp != NULL; bp = GET_NEXT(bp)) {
+            if(verbose)
+                printlist(bp);
+            /* mismatched prev and next block */
+            if((GET_NEXT(bp) != NULL) && (GET_PREV(GET_NEXT(bp)) != bp))
+                printf("Error: the double-linked list is broken\n");
+            /* block in a wrong order */
+            if(GET_SIZE(HDRP(bp)) != (1U << order))
+                printf("Error: block in the wrong order\n");
+            /* check if any allocated block still in the free list */
+            if(GET_ALLOC(HDRP(bp)))
+                printf("Error: allocated block exist in the free list\n");
+        }
+    }
+}
+
+/*
+ * print the block header
+ */
+static void printblock(void *bp)
+{
+    size_t header_size = GET_SIZE(HDRP(bp));
+    size_t header_alloc = GET_ALLOC(HDRP(bp));
+
+    printf("%p: offset: %zu header: [%zu/%c]\n", bp, BLK_OFF(bp),
+           header_size, (header_alloc ? 'a' : 'f'));
+}
+
+/*
+ * print the free list node
+ */
+static void printlist(void *bp)
+{
+    size_t header_size = GET_SIZE(HDRP(bp));
+    size_t header_alloc = GET_ALLOC(HDRP(bp));
+    void *prev_bp = GET_PREV(bp);
+    void *next_bp = GET_NEXT(bp);
+
+    printf("%p: header: [%zu/%c] prev_bp: [%p] next_bp: [%p]\n", bp,
+           header_size, (header_alloc ? 'a' : 'f'),
+           prev_bp,
+           next_bp);
+}
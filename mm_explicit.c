@@ -2,11 +2,13 @@
  * free list with immediate boundary-tag coalescing.
  * 
  * Note: this allocator uses a model of the memory system
- * provided by the memlib.c package (max heap size: 20MB).
+ * provided by the memlib.c package (max heap size: 20MB by default,
+ * see mem_init_size).
  * 
  * Allocator: explicit free list (LIFO).
- * Note: This allocator is compiled with option -m32, which sets 
- * long and pointer types to 32 bits.
+ * Note: This allocator is compiled with option -m32 by default, which sets
+ * long and pointer types to 32 bits. It also builds as native 64-bit code
+ * (make M32=), since the free list links are 32-bit heap offsets.
  * 
  * heap block: boundary tags on both free and allocated blocks.
  */
@@ -15,6 +17,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -47,6 +51,7 @@ team_t team = {
 /* private global variables */
 static char *heap_listp;
 static char *freelist_root;  /* start ptr for explixit free list */
+static char *heap_base;      /* mem_heap_lo(), base of the free list links */
 #ifdef NEXT_FIT
 static char *prev_hit;
 #endif
@@ -104,11 +109,28 @@ static void printlist(void *bp);
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* free list links are 32-bit offsets from the first heap byte, so that two
+ * links fit in the 8-byte payload of a min block with 64-bit pointers too.
+ * Offset 0 (the alignment padding word) stands for NULL. */
+#define GET_LINK(p)        link_ptr(GETW(p))
+#define PUT_LINK(p, ptr)   PUTW((p), link_off(ptr))
+
 /* double-linked free list manipulations */
-#define GET_PREV(bp)       ((void *)(*(unsigned int *)(bp)))
-#define PUT_PREV(bp, val)  (*(unsigned int *)(bp) = (unsigned int)(val))
-#define GET_NEXT(bp)       ((void *)(*((unsigned int *)(bp) + 1)))
-#define PUT_NEXT(bp, val)  (*((unsigned int *)(bp) + 1) = (unsigned int)(val))
+#define GET_PREV(bp)       GET_LINK(bp)
+#define PUT_PREV(bp, val)  PUT_LINK((bp), (val))
+#define GET_NEXT(bp)       GET_LINK((char *)(bp) + WSIZE)
+#define PUT_NEXT(bp, val)  PUT_LINK((char *)(bp) + WSIZE, (val))
+
+/* convert between a free list link offset and a block ptr */
+static inline void *link_ptr(unsigned int off)
+{
+    return off ? (void *)(heap_base + off) : NULL;
+}
+
+static inline unsigned int link_off(void *ptr)
+{
+    return ptr ? (unsigned int)((char *)ptr - heap_base) : 0;
+}
 
 /* 
  * mm_init - initialize the malloc package.
@@ -117,6 +139,7 @@ static void printlist(void *bp);
 int mm_init(void)
 {
     /* create the initial empty heap */
+    heap_base = mem_heap_lo();
     if((heap_listp = mem_sbrk(6*WSIZE)) == (void *)-1)
         return -1;
     PUTW(heap_listp, 0);                           /* alignment padding */
@@ -227,14 +250,134 @@ void *mm_realloc(void *ptr, size_t size)
             return bp;
     }
     else { /* realloc a new block */
+        /* the old block is in no list, keep a heap extension in mm_malloc
+         * from coalescing with it */
+        PUTW(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), 1));
+        PUTW(FTRP(bp), PACK(GET_SIZE(HDRP(bp)), 1));
         if((new_bp = mm_malloc(size)) == NULL)
             return NULL;
         memmove(new_bp, ptr, (old_size - 2*WSIZE));
-        insert_root(bp);  /* re-insert the old block to the root of the free list */
+        mm_free(bp);  /* re-insert the old block to the free list */
         return (void *)new_bp;
     }
 }
 
+/*
+ * mm_calloc - allocate a zeroed array of nmemb elements of size bytes.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    char *bp;
+
+    /* the array size must not overflow */
+    if((nmemb != 0) && (size > (size_t)-1 / nmemb))
+        return NULL;
+    size *= nmemb;
+
+    if((bp = mm_malloc(size)) != NULL)
+        memset(bp, 0, size);
+    return (void *)bp;
+}
+
+/*
+ * mm_memalign - allocate a block whose payload address is a multiple of
+ * alignment (a power of two). The slack in front of the aligned payload is
+ * split off and freed, the slack behind it is kept in the block.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    char *bp, *p;
+    size_t lead, bsize;
+
+    if((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if(alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if(size == 0)
+        return NULL;
+
+    /* the lead must hold a min block (4 words) */
+    if((bp = mm_malloc(size + alignment + 2*DSIZE)) == NULL)
+        return NULL;
+
+    p = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+    if(p != bp) {
+        if(p - bp < 2*DSIZE)
+            p += alignment;
+        lead = p - bp;
+        bsize = GET_SIZE(HDRP(bp));
+        PUTW(HDRP(p), PACK(bsize - lead, 1));
+        PUTW(FTRP(p), PACK(bsize - lead, 1));
+        PUTW(HDRP(bp), PACK(lead, 1));
+        PUTW(FTRP(bp), PACK(lead, 1));
+        mm_free(bp);
+    }
+    return (void *)p;
+}
+
+/*
+ * mm_posix_memalign - mm_memalign with the posix_memalign interface.
+ * return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    /* alignment must be a power of two multiple of sizeof(void *) */
+    if((alignment == 0) || (alignment & (alignment - 1)) || (alignment % sizeof(void *)))
+        return EINVAL;
+    if(((bp = mm_memalign(alignment, size)) == NULL) && (size != 0))
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_usable_size - the number of bytes that can be used in the block ptr
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if(ptr == NULL)
+        return 0;
+    return GET_SIZE(HDRP(ptr)) - DSIZE;  /* header and footer */
+}
+
+/*
+ * mm_malloc_batch - allocate n blocks of at least size bytes each into
+ * ptrs, return the number of blocks allocated (less than n if out of memory).
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if((ptrs[k] = mm_malloc(size)) == NULL)
+            break;
+    }
+    return k;
+}
+
+/*
+ * mm_free_batch - free the n blocks in ptrs, NULL entries are skipped.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if(ptrs[k] != NULL)
+            mm_free(ptrs[k]);
+    }
+}
+
+/*
+ * mm_free_sized - same as mm_free, the size is not used.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    mm_free(ptr);
+}
+
 /* 
  * mm_checkheap - Check the heap for correctness
  * This function is meant to be called through gdb
@@ -266,9 +409,10 @@ static void *extend_heap(size_t size)
 {
     char *bp;
 
-    /* allocate an even number of words to maintain allignment */
+    /* allocate an even number of words to maintain allignment,
+     * a size beyond INT_MAX would reach mem_sbrk as a shrink */
     size  =  ALIGN(size);
-    if((bp = mem_sbrk(size)) == (void *)-1)
+    if((size > INT_MAX) || ((bp = mem_sbrk(size)) == (void *)-1))
         return NULL;
 
     /* initialize free block header and footer and the epilogue header */
@@ -2,7 +2,8 @@
  * free list with immediate boundary-tag coalescing.
  * 
  * Note: this allocator uses a model of the memory system
- * provided by the memlib.c package (max heap size: 20MB).
+ * provided by the memlib.c package (max heap size: 20MB by default,
+ * see mem_init_size).
  * 
  * Allocator: implicit free list.
  * heap block: boundary tag on both header and footer for free blocks.
@@ -13,6 +14,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -122,9 +125,10 @@ static void *extend_heap(size_t size)
     char *bp;
     size_t prev_alloc;
 
-    /* allocate an even number of words to maintain allignment */
+    /* allocate an even number of words to maintain allignment,
+     * a size beyond INT_MAX would reach mem_sbrk as a shrink */
     size  =  ALIGN(size);
-    if((bp = mem_sbrk(size)) == (void *)-1)
+    if((size > INT_MAX) || ((bp = mem_sbrk(size)) == (void *)-1))
         return NULL;
 
     prev_alloc = GET_PREV_ALLOC(HDRP(bp));
@@ -340,3 +344,117 @@ void *mm_realloc(void *ptr, size_t size)
     mm_free(ptr);  /* free the old block */
     return (void *)new_bp;
 }
+
+/*
+ * mm_calloc - allocate a zeroed array of nmemb elements of size bytes.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    char *bp;
+
+    /* the array size must not overflow */
+    if((nmemb != 0) && (size > (size_t)-1 / nmemb))
+        return NULL;
+    size *= nmemb;
+
+    if((bp = mm_malloc(size)) != NULL)
+        memset(bp, 0, size);
+    return (void *)bp;
+}
+
+/*
+ * mm_memalign - allocate a block whose payload address is a multiple of
+ * alignment (a power of two). The slack in front of the aligned payload is
+ * split off and freed, the slack behind it is kept in the block.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    char *bp, *p;
+    size_t lead, bsize;
+
+    if((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if(alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if(size == 0)
+        return NULL;
+
+    /* the lead must hold a min block (4 words) */
+    if((bp = mm_malloc(size + alignment + 2*DSIZE)) == NULL)
+        return NULL;
+
+    p = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+    if(p != bp) {
+        if(p - bp < 2*DSIZE)
+            p += alignment;
+        lead = p - bp;
+        bsize = GET_SIZE(HDRP(bp));
+        PUTW(HDRP(p), PACK(bsize - lead, 1, 1));
+        PUTW(HDRP(bp), PACK(lead, GET_PREV_ALLOC(HDRP(bp)), 1));
+        mm_free(bp);
+    }
+    return (void *)p;
+}
+
+/*
+ * mm_posix_memalign - mm_memalign with the posix_memalign interface.
+ * return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    /* alignment must be a power of two multiple of sizeof(void *) */
+    if((alignment == 0) || (alignment & (alignment - 1)) || (alignment % sizeof(void *)))
+        return EINVAL;
+    if(((bp = mm_memalign(alignment, size)) == NULL) && (size != 0))
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_usable_size - the number of bytes that can be used in the block ptr
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if(ptr == NULL)
+        return 0;
+    return GET_SIZE(HDRP(ptr)) - WSIZE;  /* header only */
+}
+
+/*
+ * mm_malloc_batch - allocate n blocks of at least size bytes each into
+ * ptrs, return the number of blocks allocated (less than n if out of memory).
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if((ptrs[k] = mm_malloc(size)) == NULL)
+            break;
+    }
+    return k;
+}
+
+/*
+ * mm_free_batch - free the n blocks in ptrs, NULL entries are skipped.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if(ptrs[k] != NULL)
+            mm_free(ptrs[k]);
+    }
+}
+
+/*
+ * mm_free_sized - same as mm_free, the size is not used.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    mm_free(ptr);
+}
@@ -0,0 +1,749 @@
+/* mm.c - a simple dynamic memory allocator based on a two-level
+ * segregated fit (TLSF) free list with immediate boundary-tag coalescing.
+ *
+ * Note: this allocator uses a model of the memory system
+ * provided by the memlib.c package (max heap size: 20MB by default,
+ * see mem_init_size).
+ *
+ * Allocator: two-level segregated fit.
+ * Note: This allocator is compiled with option -m32 by default, which sets
+ * long and pointer types to 32 bits. It also builds as native 64-bit code
+ * (make M32=), since the free list links are 32-bit heap offsets.
+ *
+ * heap block: boundary tags on both free and allocated blocks.
+ *
+ * free list: the first level splits the sizes by power of two, the second
+ * level splits every power-of-two range into SLN linear classes. One bit per
+ * non-empty list is kept in a first-level bitmap and in one second-level
+ * bitmap per first-level class, so both find_fit and insert_list are
+ * constant-time bit-scan operations instead of list walks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/*********************************************************
+ * NOTE TO STUDENTS: Before you do anything else, please
+ * provide your team information in the following struct.
+ ********************************************************/
+team_t team = {
+    /* Team name */
+    "ateam",
+    /* First member's full name */
+    "Harry Bovik",
+    /* First member's email address */
+    "bovik@cs.cmu.edu",
+    /* Second member's full name (leave blank if none) */
+    "",
+    /* Second member's email address (leave blank if none) */
+    ""
+};
+
+/* private global variables */
+static char *heap_listp;
+static char *tlsf_root;  /* start ptr for the bitmaps and the list heads */
+static char *heap_base;  /* mem_heap_lo(), base of the free list links */
+
+/* private functions */
+static void *extend_heap(size_t size);
+static void *find_fit(size_t asize);
+static void *coalesce(void *bp);
+static void place(void *bp, size_t asize);
+static void mapping(size_t size, size_t *fl, size_t *sl);
+static void insert_list(void *bp);
+static void detach_node(void *bp);
+
+/* heap checker */
+void mm_checkheap(int verbose);
+void mm_checklist(int verbose);
+static void checkheap(int verbose);
+static void checkblock(void *bp);
+static void printblock(void *bp);
+static void checklist(int verbose);
+static void printlist(void *bp);
+
+/* basic constants and macros */
+#define WSIZE 4             /* word size (bytes) */
+#define DSIZE 8             /* double word size (bytes) */
+#define CHUNKSIZE (1<<12)   /* extend heap by 4kB */
+#define MAX_REQUEST (1<<30) /* larger requests fail, sizes must fit in an int */
+
+#define MAX(x, y) ((x) > (y)? (x):(y))
+
+/* pack a size and allocated bit into a word */
+#define PACK(size, alloc) ((size)|(alloc))
+
+/* read and write a word at address p */
+#define GETW(p)       (*(unsigned int *)(p))
+#define PUTW(p, val)  (*(unsigned int *)(p) = (unsigned int)(val))
+
+/* read the size and allocated fields from address p */
+#define GET_SIZE(p)   (GETW(p) & ~0x7)
+#define GET_ALLOC(p)  (GETW(p) & 0x1)
+
+/* given block ptr bp, compute address of its header and footer */
+#define HDRP(bp)      ((char *)(bp) - WSIZE)
+#define FTRP(bp)      ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* given block ptr bp, compute address of next and previous blocks */
+#define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+
+
+#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+
+/* free list links are 32-bit offsets from the first heap byte, so that two
+ * links fit in the 8-byte payload of a min block with 64-bit pointers too.
+ * Offset 0 (the first-level bitmap) stands for NULL. */
+#define GET_LINK(p)        link_ptr(GETW(p))
+#define PUT_LINK(p, ptr)   PUTW((p), link_off(ptr))
+
+/* double-linked free list manipulations */
+#define GET_NEXT(bp)       GET_LINK(bp)
+#define PUT_NEXT(bp, ptr)  PUT_LINK((bp), (ptr))
+#define GET_PREV(bp)       GET_LINK((char *)(bp) + WSIZE)
+#define PUT_PREV(bp, ptr)  PUT_LINK((char *)(bp) + WSIZE, (ptr))
+
+/*
+ * two-level size classes:
+ * sizes < SMALL_SIZE are kept in fl 0 with a linear step of ALIGNMENT,
+ * sizes >= SMALL_SIZE with msb n are kept in fl (n - FL_SHIFT + 1).
+ */
+#define SL_LOG2     3                      /* log2 of second level classes */
+#define SLN         (1<<SL_LOG2)           /* second level classes per fl */
+#define FL_SHIFT    (SL_LOG2 + 3)          /* log2(SLN * ALIGNMENT) */
+#define SMALL_SIZE  (1<<FL_SHIFT)          /* smallest size with fl > 0 */
+#define FLN         (32 - FL_SHIFT + 1)    /* first level classes */
+
+/* index of the most and least significant set bit (x != 0) */
+#define FLS(x)        (31 - __builtin_clz(x))
+#define FFS(x)        (__builtin_ctz(x))
+
+/* address of the bitmaps and the list heads (relative to tlsf_root) */
+#define FL_MAPP              (tlsf_root)
+#define SL_MAPP(fl)          (tlsf_root + WSIZE*(1 + (fl)))
+#define HEADP(fl, sl)        (tlsf_root + WSIZE*(1 + FLN + (fl)*SLN + (sl)))
+
+/* words in front of the prologue header (must be odd to align heap_listp) */
+#define TLSF_WORDS           (1 + FLN + FLN*SLN)
+#define ROOT_WORDS           (TLSF_WORDS + !(TLSF_WORDS & 0x1))
+
+/* convert between a free list link offset and a block ptr */
+static inline void *link_ptr(unsigned int off)
+{
+    return off ? (void *)(heap_base + off) : NULL;
+}
+
+static inline unsigned int link_off(void *ptr)
+{
+    return ptr ? (unsigned int)((char *)ptr - heap_base) : 0;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ * return 0 on success, -1 on error
+ */
+int mm_init(void)
+{
+    int i;
+
+    /* create the initial empty heap */
+    heap_base = mem_heap_lo();
+    if((tlsf_root = mem_sbrk((ROOT_WORDS + 3)*WSIZE)) == (void *)-1)
+        return -1;
+    /* clear both bitmaps and every list head (and the alignment padding) */
+    for(i = 0; i < ROOT_WORDS; i++)
+        PUTW(tlsf_root + (WSIZE*i), 0);
+    heap_listp = tlsf_root + (WSIZE*ROOT_WORDS);
+    PUTW(heap_listp, PACK(DSIZE, 1));                /* prologue header */
+    PUTW(heap_listp + (WSIZE*1), PACK(DSIZE, 1));    /* prologue footer */  /* <- heap_listp */
+    PUTW(heap_listp + (WSIZE*2), PACK(0, 1));        /* epilogue header */
+    heap_listp += WSIZE;
+
+    /* extend the empty heap size (bytes) */
+    if(extend_heap(2*DSIZE) == NULL)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * mm_malloc -
+ * Always allocate a block whose size is a multiple of the alignment.
+ */
+void *mm_malloc(size_t size)
+{
+    size_t asize;
+    size_t extendsize;
+    char *bp;
+
+    /* ignore spurious requests */
+    if((size == 0) || (size > MAX_REQUEST))
+        return NULL;
+
+    /* min block size = 4 words (header + footer + 2 words free block) */
+    if(size <= DSIZE)
+        asize = 2*DSIZE;
+    else
+        asize = ALIGN(size + 2*WSIZE);
+
+    /* search the free list for a fit */
+    if((bp = find_fit(asize)) != NULL) {
+        detach_node(bp);
+        place(bp, asize);
+        return (void *)bp;
+    }
+
+    /* no fit found, extend heap to place the block */
+    extendsize = MAX(asize, CHUNKSIZE);
+    if((bp = extend_heap(extendsize)) == NULL)
+        return NULL;
+
+    detach_node(bp);
+    place(bp, asize);
+    return (void *)bp;
+}
+
+/*
+ * mm_free - Freeing a block and coalesce prev/next free block if exist.
+ */
+void mm_free(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+
+    PUTW(HDRP(bp), PACK(size, 0));
+    PUTW(FTRP(bp), PACK(size, 0));
+
+    bp = coalesce(bp);
+    insert_list(bp);
+}
+
+/*
+ * mm_realloc - shrink or grow the block in place if possible.
+ * The block is grown into the next block if it is free and large enough,
+ * otherwise a new block is allocated and the old one is freed.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    char *next_bp, *new_bp;
+    size_t old_size, asize;
+
+    /* if ptr is NULL, the call is equivalent to mm malloc(size) */
+    if(ptr == NULL)
+        return mm_malloc(size);
+    /* if size is equal to zero, the call is equivalent to mm free(ptr) */
+    if(size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    if(size > MAX_REQUEST)
+        return NULL;
+
+    old_size = GET_SIZE(HDRP(ptr));
+    if(size <= DSIZE)
+        asize = 2*DSIZE;
+    else
+        asize = ALIGN(size + 2*WSIZE);
+
+    /* shrink (or keep) the block in place */
+    if(asize <= old_size) {
+        place(ptr, asize);
+        return ptr;
+    }
+
+    /* grow the block into the next free block */
+    next_bp = NEXT_BLKP(ptr);
+    if(!GET_ALLOC(HDRP(next_bp)) && (old_size + GET_SIZE(HDRP(next_bp)) >= asize)) {
+        detach_node(next_bp);
+        old_size += GET_SIZE(HDRP(next_bp));
+        PUTW(HDRP(ptr), PACK(old_size, 1));
+        PUTW(FTRP(ptr), PACK(old_size, 1));
+        place(ptr, asize);
+        return ptr;
+    }
+
+    /* realloc a new block */
+    if((new_bp = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(new_bp, ptr, (old_size - 2*WSIZE));
+    mm_free(ptr);
+    return (void *)new_bp;
+}
+
+/*
+ * mm_calloc - allocate a zeroed array of nmemb elements of size bytes.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    char *bp;
+
+    /* the array size must not overflow */
+    if((nmemb != 0) && (size > (size_t)-1 / nmemb))
+        return NULL;
+    size *= nmemb;
+
+    if((bp = mm_malloc(size)) != NULL)
+        memset(bp, 0, size);
+    return (void *)bp;
+}
+
+/*
+ * mm_memalign - allocate a block whose payload address is a multiple of
+ * alignment (a power of two). The slack in front of the aligned payload is
+ * split off and freed, the slack behind it is kept in the block.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    char *bp, *p;
+    size_t lead, bsize;
+
+    if((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if(alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if((size == 0) || (size > MAX_REQUEST) || (alignment > MAX_REQUEST))
+        return NULL;
+
+    /* the lead must hold a min block (4 words) */
+    if((bp = mm_malloc(size + alignment + 2*DSIZE)) == NULL)
+        return NULL;
+
+    p = (char *)(((size_t)bp + alignment - 1) & ~(alignment - 1));
+    if(p != bp) {
+        if(p - bp < 2*DSIZE)
+            p += alignment;
+        lead = p - bp;
+        bsize = GET_SIZE(HDRP(bp));
+        PUTW(HDRP(p), PACK(bsize - lead, 1));
+        PUTW(FTRP(p), PACK(bsize - lead, 1));
+        PUTW(HDRP(bp), PACK(lead, 1));
+        PUTW(FTRP(bp), PACK(lead, 1));
+        mm_free(bp);
+    }
+    return (void *)p;
+}
+
+/*
+ * mm_posix_memalign - mm_memalign with the posix_memalign interface.
+ * return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    /* alignment must be a power of two multiple of sizeof(void *) */
+    if((alignment == 0) || (alignment & (alignment - 1)) || (alignment % sizeof(void *)))
+        return EINVAL;
+    if(((bp = mm_memalign(alignment, size)) == NULL) && (size != 0))
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_usable_size - the number of bytes that can be used in the block ptr
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if(ptr == NULL)
+        return 0;
+    return GET_SIZE(HDRP(ptr)) - DSIZE;  /* header and footer */
+}
+
+/*
+ * mm_malloc_batch - allocate n blocks of at least size bytes each into
+ * ptrs, return the number of blocks allocated (less than n if out of memory).
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if((ptrs[k] = mm_malloc(size)) == NULL)
+            break;
+    }
+    return k;
+}
+
+/*
+ * mm_free_batch - free the n blocks in ptrs, NULL entries are skipped.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t k;
+
+    for(k = 0; k < n; k++) {
+        if(ptrs[k] != NULL)
+            mm_free(ptrs[k]);
+    }
+}
+
+/*
+ * mm_free_sized - same as mm_free, the size is not used.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    mm_free(ptr);
+}
+
+/*
+ * mm_checkheap - Check the heap for correctness
+ * This function is meant to be called through gdb
+ */
+void mm_checkheap(int verbose)
+{
+    checkheap(verbose);
+}
+
+/*
+ * mm_checklist- Check the free list for correctness
+ * This function is meant to be called through gdb
+ */
+void mm_checklist(int verbose)
+{
+    checklist(verbose);
+}
+
+/*
+ * internal helper functions
+ */
+
+/*
+ * The extend_heap function is invoked in two different circumstances:
+ * (1) when the heap is initialized
+ * (2) when mm_malloc is unable to find a suitable fit.
+ */
+static void *extend_heap(size_t size)
+{
+    char *bp;
+
+    /* allocate an even number of words to maintain allignment,
+     * a size beyond INT_MAX would reach mem_sbrk as a shrink */
+    size  =  ALIGN(size);
+    if((size > INT_MAX) || ((bp = mem_sbrk(size)) == (void *)-1))
+        return NULL;
+
+    /* initialize free block header and footer and the epilogue header */
+    PUTW(HDRP(bp), PACK(size, 0));          /* free block header */
+    PUTW(FTRP(bp), PACK(size, 0));          /* free block footer */
+    PUTW(HDRP(NEXT_BLKP(bp)), PACK(0, 1));  /* new epilogue header */
+
+    /* coalesce if the previous block was free */
+    bp = coalesce(bp);
+
+    /* insert the new block to the free list */
+    insert_list(bp);
+
+    return bp;
+}
+
+/*
+ * mapping - calculate the first level class fl and second level class sl
+ * of a block size.
+ */
+static void mapping(size_t size, size_t *fl, size_t *sl)
+{
+    size_t n;
+
+    if(size < SMALL_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_SIZE / SLN);
+    }
+    else {
+        n = FLS(size);
+        *fl = n - FL_SHIFT + 1;
+        *sl = (size >> (n - SL_LOG2)) ^ SLN;
+    }
+}
+
+/*
+ * find_fit - good-fit search in constant time
+ * The head of the exact class is tried first, then asize is rounded up to
+ * the next class so that any block of a larger non-empty class will fit.
+ */
+static void *find_fit(size_t asize)
+{
+    char *bp;
+    size_t fl, sl;
+    unsigned int fl_map, sl_map;
+
+    /* the head of the exact class is a fit for most requests */
+    mapping(asize, &fl, &sl);
+    if(fl >= FLN)
+        return NULL;
+    bp = GET_NEXT(HEADP(fl, sl));
+    if((bp != NULL) && (asize <= GET_SIZE(HDRP(bp))))
+        return (void *)bp;
+
+    /* round up to the next class, every block there is a fit */
+    if(asize >= SMALL_SIZE)
+        asize += (1 << (FLS(asize) - SL_LOG2)) - 1;
+    mapping(asize, &fl, &sl);
+    if(fl >= FLN)
+        return NULL;
+
+    /* search the second level first, then the next first level class */
+    sl_map = GETW(SL_MAPP(fl)) & (~0U << sl);
+    if(!sl_map) {
+        if(fl + 1 >= FLN)
+            return NULL;
+        fl_map = GETW(FL_MAPP) & (~0U << (fl + 1));
+        if(!fl_map)
+            return NULL;  /* no fit */
+        fl = FFS(fl_map);
+        sl_map = GETW(SL_MAPP(fl));
+    }
+    sl = FFS(sl_map);
+
+    return GET_NEXT(HEADP(fl, sl));
+}
+
+/*
+ * place - update the footer and header for both the allocated block and
+ * the remainder of the free block (if exist).
+ * The free block only got splitted when the remainder of the free block also
+ * follows the alignment requirement, otherwise the whole free block would
+ * being used instead.
+ *
+ * Note: Internal fragmentation increases in the case (free size - asize) <= 2.
+ */
+static void place(void *bp, size_t asize)
+{
+    size_t fsize = GET_SIZE(HDRP(bp));  /* size of the choosed free block */
+
+    /* if the remainder of the free block > required min block size (4 words) */
+    if((fsize - asize) >= (2*DSIZE)) {
+        PUTW(HDRP(bp), PACK(asize, 1));  /* allocated block header */
+        PUTW(FTRP(bp), PACK(asize, 1));  /* allocated block footer */
+        fsize -= asize;                  /* size of the remainder of the free block */
+        bp = NEXT_BLKP(bp);              /* point bp to the remainder */
+        PUTW(HDRP(bp), PACK(fsize, 0));  /* new free block header */
+        PUTW(FTRP(bp), PACK(fsize, 0));  /* new free block footer */
+        /* the remainder may border a free block when shrinking in realloc */
+        bp = coalesce(bp);
+        insert_list(bp);
+    }
+    else {  /* use the whole free block without splitting */
+        PUTW(HDRP(bp), PACK(fsize, 1));  /* allocated block header */
+        PUTW(FTRP(bp), PACK(fsize, 1));  /* allocated block footer */
+    }
+}
+
+/*
+ * coalesce - merges adjacent free blocks using the boundary-tags coalescing technique
+ */
+static void *coalesce(void *bp)
+{
+    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    /* prev and next allocated */
+    if(prev_alloc && next_alloc) {
+        return bp;
+    }
+    /* prev allocated, next free */
+    else if(prev_alloc && !next_alloc) {
+        detach_node(NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUTW(HDRP(bp), PACK(size, 0));
+        PUTW(FTRP(bp), PACK(size, 0));
+    }
+    /* prev free, next allocated */
+    else if(!prev_alloc && next_alloc) {
+        detach_node(PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        bp = PREV_BLKP(bp);
+        PUTW(HDRP(bp), PACK(size, 0));
+        PUTW(FTRP(bp), PACK(size, 0));
+    }
+    /* prev and next free */
+    else {
+        detach_node(NEXT_BLKP(bp));
+        detach_node(PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
+        bp = PREV_BLKP(bp);
+        PUTW(HDRP(bp), PACK(size, 0));
+        PUTW(FTRP(bp), PACK(size, 0));
+    }
+
+    return bp;
+}
+
+/*
+ * insert bp to the root of its class and mark the class as non-empty
+ */
+static void insert_list(void *bp)
+{
+    char *head;
+    char *next_node;
+    size_t fl, sl;
+
+    mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+    head = HEADP(fl, sl);
+    next_node = GET_NEXT(head);
+
+    PUT_NEXT(head, bp);
+    PUT_PREV(bp, head);
+    PUT_NEXT(bp, next_node);
+    if(next_node != NULL)
+        PUT_PREV(next_node, bp);
+
+    PUTW(FL_MAPP, GETW(FL_MAPP) | (1U << fl));
+    PUTW(SL_MAPP(fl), GETW(SL_MAPP(fl)) | (1U << sl));
+}
+
+/*
+ * detach bp from its class and clear the bitmaps if the class is empty
+ *
+ * Note: need to re-insert bp back to the list after manipulation finished.
+ */
+static void detach_node(void *bp)
+{
+    char *next_bp = GET_NEXT(bp);
+    char *prev_bp = GET_PREV(bp);
+    size_t fl, sl;
+
+    PUT_NEXT(prev_bp, next_bp);  /* update prev free block (or list head) */
+    if(next_bp != NULL)
+        PUT_PREV(next_bp, prev_bp);  /* update next free block */
+
+    mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+    if(GET_NEXT(HEADP(fl, sl)) == NULL) {
+        PUTW(SL_MAPP(fl), GETW(SL_MAPP(fl)) & ~(1U << sl));
+        if(GETW(SL_MAPP(fl)) == 0)
+            PUTW(FL_MAPP, GETW(FL_MAPP) & ~(1U << fl));
+    }
+}
+
+/*
+ * check the consistency of heap
+ */
+static void checkheap(int verbose)
+{
+    char *bp = heap_listp;
+
+    /* chech prelogue block */
+    if((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
+        printf("Bad prologue header\n");
+
+    if((GET_SIZE(FTRP(heap_listp)) != DSIZE) || !GET_ALLOC(FTRP(heap_listp)))
+        printf("Error: bad prologue footer\n");
+
+    /* check heap */
+    for(bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if(verbose)
+            printblock(bp);
+        checkblock(bp);
+    }
+
+    /* check epilogue block */
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
+        printf("Error: bad epilogue header\n");
+
+    if(bp != (mem_heap_hi() + 1))
+        printf("Error: epilogue is not at the end of heap\n");
+}
+
+/*
+ * check the heap content
+ */
+static void checkblock(void *bp)
+{
+    if((size_t)bp % 8) {
+        printf("Error: bp is not doubleword aligned\n");
+        printblock(bp);
+    }
+
+    if(GETW(HDRP(bp)) != GETW(FTRP(bp))) {
+        printf("Error: header does not match footer\n");
+        printblock(bp);
+    }
+    if(!GET_ALLOC(HDRP(bp))) {
+        if(!GET_ALLOC(HDRP(PREV_BLKP(bp))) || !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+            printf("Error: contiguous free block\n");
+    }
+}
+
+/*
+ * check the two-level free lists and the bitmaps
+ */
+static void checklist(int verbose)
+{
+    char *bp;
+    size_t fl, sl, bfl, bsl;
+    int empty;
+
+    for(fl = 0; fl < FLN; fl++) {
+        if(!(GETW(FL_MAPP) & (1U << fl)) != !GETW(SL_MAPP(fl)))
+            printf("Error: first level bitmap mismatch at fl %zu\n", fl);
+        for(sl = 0; sl < SLN; sl++) {
+            empty = (GET_NEXT(HEADP(fl, sl)) == NULL);
+            if(empty != !(GETW(SL_MAPP(fl)) & (1U << sl)))
+                printf("Error: second level bitmap mismatch at fl %zu sl %zu\n", fl, sl);
+            if(verbose && !empty)
+                printf("Size class: fl %zu sl %zu\n", fl, sl);
+            for(bp = GET_NEXT(HEADP(fl, sl)); bp != NULL; bp = GET_NEXT(bp)) {
+                if(verbose)
+                    printlist(bp);
+                /* mismatched prev and next block */
+                if((GET_NEXT(bp) != NULL) && (GET_PREV(GET_NEXT(bp)) != bp))
+                    printf("Error: the double-linked list is broken\n");
+                /* block in a wrong class */
+                mapping(GET_SIZE(HDRP(bp)), &bfl, &bsl);
+                if((bfl != fl) || (bsl != sl))
+                    printf("Error: block in the wrong size class\n");
+                /* check if any allocated block still in the free list */
+                if(GET_ALLOC(HDRP(bp)) || GET_ALLOC(FTRP(bp)))
+                    printf("Error: allocated block exist in the free list\n");
+            }
+        }
+    }
+}
+
+/*
+ * print the block header and footer
+ */
+static void printblock(void *bp)
+{
+    size_t header_size = GET_SIZE(HDRP(bp));
+    size_t header_alloc = GET_ALLOC(HDRP(bp));
+    size_t footer_size = GET_SIZE(FTRP(bp));
+    size_t footer_alloc = GET_ALLOC(FTRP(bp));
+
+    printf("%p: header: [%zu/%c] footer: [%zu/%c]\n", bp,
+           header_size, (header_alloc ? 'a' : 'f'),
+           footer_size, (footer_alloc ? 'a' : 'f'));
+}
+
+/*
+ * print the two-level free list node
+ */
+static void printlist(void *bp)
+{
+    size_t header_size = GET_SIZE(HDRP(bp));
+    size_t header_alloc = GET_ALLOC(HDRP(bp));
+    size_t footer_size = GET_SIZE(FTRP(bp));
+    size_t footer_alloc = GET_ALLOC(FTRP(bp));
+    void *prev_bp = GET_PREV(bp);
+    void *next_bp = GET_NEXT(bp);
+
+    printf("%p: header: [%zu/%c] footer: [%zu/%c] prev_bp: [%p] next_bp: [%p]\n", bp,
+           header_size, (header_alloc ? 'a' : 'f'),
+           footer_size, (footer_alloc ? 'a' : 'f'),
+           prev_bp,
+           next_bp);
+}